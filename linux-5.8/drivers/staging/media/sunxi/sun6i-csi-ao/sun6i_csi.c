@@ -5,7 +5,9 @@
  * Author: Yong Deng <yong.deng@magewell.com>
  */
 
+#include <linux/bitfield.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/dma-mapping.h>
 #include <linux/err.h>
@@ -13,6 +15,7 @@
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/ioctl.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
@@ -21,25 +24,235 @@
 #include <linux/regmap.h>
 #include <linux/reset.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/sizes.h>
 #include <linux/slab.h>
 
+#include <media/v4l2-rect.h>
+
 #include "sun6i_csi.h"
 #include "sun6i_csi_reg.h"
+#include "sun6i_dphy_reg.h"
 #include "sun6i_mipi.h"
+#include "sun6i_mipi_reg.h"
+
+#define CREATE_TRACE_POINTS
+#include "sun6i_csi_trace.h"
 
 #define MODULE_NAME	"sun6i-csi"
 
+static bool warm_restart;
+module_param(warm_restart, bool, 0644);
+MODULE_PARM_DESC(warm_restart,
+		 "Keep the MIPI receiver and DPHY running across STREAMOFF");
+
+static bool dphy_lp_idle;
+module_param(dphy_lp_idle, bool, 0644);
+MODULE_PARM_DESC(dphy_lp_idle,
+		 "Keep the DPHY analog front-end up when stopped, to resume fast");
+
+/* Where the MIPI receiver goes when it stops */
+static enum sun6i_mipi_state sun6i_csi_mipi_stopped(void)
+{
+	return dphy_lp_idle ? SUN6I_MIPI_IDLE : SUN6I_MIPI_OFF;
+}
+
+/* Long enough to cover a format or bitrate switch */
+#define SUN6I_CSI_AUTOSUSPEND_MS	1000
+
+/* The frame and IRQ clock counters run from the 24MHz oscillator. */
+#define CSI_CNT_CLK_MHZ	24
+
 static inline struct sun6i_csi_dev *sun6i_csi_to_dev(struct sun6i_csi *csi)
 {
 	return container_of(csi, struct sun6i_csi_dev, csi);
 }
 
-/* TODO add 10&12 bit YUV, RGB support */
+#define SUN6I_CSI_BAYER(_pix, _code, _bits)				\
+	{								\
+		.pixelformat	= V4L2_PIX_FMT_##_pix,			\
+		.mbus_code	= MEDIA_BUS_FMT_##_code,		\
+		.input_fmt	= CSI_INPUT_FORMAT_RAW,			\
+		.output_fmt	= CSI_FIELD_RAW_##_bits,		\
+		.output_fmt_frame = CSI_FRAME_RAW_##_bits,		\
+		.mipi_dt	= MIPI_RAW##_bits,			\
+		.bpp		= _bits,				\
+		.planes		= 1,					\
+		.hsize_mul	= 1,					\
+	}
+
+/* Packed YUV is captured as raw bytes, two of them per pixel */
+#define SUN6I_CSI_YUV_PACKED(_pix, _code, _seq)				\
+	{								\
+		.pixelformat	= V4L2_PIX_FMT_##_pix,			\
+		.mbus_code	= MEDIA_BUS_FMT_##_code,		\
+		.input_fmt	= CSI_INPUT_FORMAT_RAW,			\
+		.output_fmt	= CSI_FIELD_RAW_8,			\
+		.output_fmt_frame = CSI_FRAME_RAW_8,			\
+		.input_seq	= CSI_INPUT_SEQ_##_seq,			\
+		.mipi_dt	= MIPI_YUV422,				\
+		.bpp		= 16,					\
+		.planes		= 1,					\
+		.hsize_mul	= 2,					\
+		.yuv		= true,					\
+	}
+
+#define SUN6I_CSI_YUV(_pix, _code, _seq, _out, _bpp, _planes, _vdiv, _bus16) \
+	{								\
+		.pixelformat	= V4L2_PIX_FMT_##_pix,			\
+		.mbus_code	= MEDIA_BUS_FMT_##_code,		\
+		.input_fmt	= CSI_INPUT_FORMAT_YUV422,		\
+		.output_fmt	= CSI_FIELD_##_out,			\
+		.output_fmt_frame = CSI_FRAME_##_out,			\
+		.input_seq	= CSI_INPUT_SEQ_##_seq,			\
+		.mipi_dt	= MIPI_YUV422,				\
+		.bpp		= _bpp,					\
+		.planes		= _planes,				\
+		.vdiv		= _vdiv,				\
+		.hsize_mul	= 1,					\
+		.bus16		= _bus16,				\
+		.yuv		= true,					\
+	}
+
+/*
+ * All 8bit YUV bus orders for one planar format, each given with the
+ * input sequence that puts U in the plane the format expects it in.
+ */
+#define SUN6I_CSI_YUV_PLANAR(_pix, _out, _bpp, _planes, _vdiv,		\
+			     _uyvy, _vyuy, _yuyv, _yvyu)		\
+	SUN6I_CSI_YUV(_pix, UYVY8_2X8, _uyvy, _out, _bpp, _planes, _vdiv, false), \
+	SUN6I_CSI_YUV(_pix, VYUY8_2X8, _vyuy, _out, _bpp, _planes, _vdiv, false), \
+	SUN6I_CSI_YUV(_pix, YUYV8_2X8, _yuyv, _out, _bpp, _planes, _vdiv, false), \
+	SUN6I_CSI_YUV(_pix, YVYU8_2X8, _yvyu, _out, _bpp, _planes, _vdiv, false), \
+	SUN6I_CSI_YUV(_pix, UYVY8_1X16, _uyvy, _out, _bpp, _planes, _vdiv, true), \
+	SUN6I_CSI_YUV(_pix, VYUY8_1X16, _vyuy, _out, _bpp, _planes, _vdiv, true), \
+	SUN6I_CSI_YUV(_pix, YUYV8_1X16, _yuyv, _out, _bpp, _planes, _vdiv, true), \
+	SUN6I_CSI_YUV(_pix, YVYU8_1X16, _yvyu, _out, _bpp, _planes, _vdiv, true)
+
+/*
+ * Every (pixformat, mbus code) pair the CSI can capture, with the register
+ * values it needs worked out at build time. Entries of one pixformat are
+ * kept together, the first one is the default format of the video node.
+ */
+static const struct sun6i_csi_format sun6i_csi_formats[] = {
+#ifdef CONFIG_VIDEO_SUN6I_MIPI_CSI_AO_FMT_BAYER
+	SUN6I_CSI_BAYER(SBGGR8, SBGGR8_1X8, 8),
+	SUN6I_CSI_BAYER(SGBRG8, SGBRG8_1X8, 8),
+	SUN6I_CSI_BAYER(SGRBG8, SGRBG8_1X8, 8),
+	SUN6I_CSI_BAYER(SRGGB8, SRGGB8_1X8, 8),
+	SUN6I_CSI_BAYER(SBGGR10, SBGGR10_1X10, 10),
+	SUN6I_CSI_BAYER(SGBRG10, SGBRG10_1X10, 10),
+	SUN6I_CSI_BAYER(SGRBG10, SGRBG10_1X10, 10),
+	SUN6I_CSI_BAYER(SRGGB10, SRGGB10_1X10, 10),
+	SUN6I_CSI_BAYER(SBGGR12, SBGGR12_1X12, 12),
+	SUN6I_CSI_BAYER(SGBRG12, SGBRG12_1X12, 12),
+	SUN6I_CSI_BAYER(SGRBG12, SGRBG12_1X12, 12),
+	SUN6I_CSI_BAYER(SRGGB12, SRGGB12_1X12, 12),
+#endif
+#ifdef CONFIG_VIDEO_SUN6I_MIPI_CSI_AO_FMT_YUV_PACKED
+	SUN6I_CSI_YUV_PACKED(YUYV, YUYV8_2X8, YUYV),
+	SUN6I_CSI_YUV_PACKED(YVYU, YVYU8_2X8, YVYU),
+	SUN6I_CSI_YUV_PACKED(UYVY, UYVY8_2X8, UYVY),
+	SUN6I_CSI_YUV_PACKED(VYUY, VYUY8_2X8, VYUY),
+#endif
+	SUN6I_CSI_YUV_PLANAR(NV12, UV_CB_YUV420, 12, 2, 2,
+			     UYVY, VYUY, YUYV, YVYU),
+#ifdef CONFIG_VIDEO_SUN6I_MIPI_CSI_AO_FMT_YUV_PLANAR
+	SUN6I_CSI_YUV_PLANAR(NV21, UV_CB_YUV420, 12, 2, 2,
+			     VYUY, UYVY, YVYU, YUYV),
+	SUN6I_CSI_YUV_PLANAR(YUV420, PLANAR_YUV420, 12, 3, 2,
+			     UYVY, VYUY, YUYV, YVYU),
+	SUN6I_CSI_YUV_PLANAR(YVU420, PLANAR_YUV420, 12, 3, 2,
+			     VYUY, UYVY, YVYU, YUYV),
+	SUN6I_CSI_YUV_PLANAR(NV16, UV_CB_YUV422, 16, 2, 1,
+			     UYVY, VYUY, YUYV, YVYU),
+	SUN6I_CSI_YUV_PLANAR(NV61, UV_CB_YUV422, 16, 2, 1,
+			     VYUY, UYVY, YVYU, YUYV),
+	SUN6I_CSI_YUV_PLANAR(YUV422P, PLANAR_YUV422, 16, 3, 1,
+			     UYVY, VYUY, YUYV, YVYU),
+#endif
+#ifdef CONFIG_VIDEO_SUN6I_MIPI_CSI_AO_FMT_RGB565
+	{
+		.pixelformat	= V4L2_PIX_FMT_RGB565,
+		.mbus_code	= MEDIA_BUS_FMT_RGB565_2X8_LE,
+		.input_fmt	= CSI_INPUT_FORMAT_RAW,
+		.output_fmt	= CSI_FIELD_RGB565,
+		.output_fmt_frame = CSI_FRAME_RGB565,
+		.mipi_dt	= MIPI_RGB565,
+		.bpp		= 16,
+		.planes		= 1,
+		.hsize_mul	= 1,
+	},
+	{
+		.pixelformat	= V4L2_PIX_FMT_RGB565X,
+		.mbus_code	= MEDIA_BUS_FMT_RGB565_2X8_BE,
+		.input_fmt	= CSI_INPUT_FORMAT_RAW,
+		.output_fmt	= CSI_FIELD_RGB565,
+		.output_fmt_frame = CSI_FRAME_RGB565,
+		.mipi_dt	= MIPI_RGB565,
+		.bpp		= 16,
+		.planes		= 1,
+		.hsize_mul	= 1,
+	},
+#endif
+#ifdef CONFIG_VIDEO_SUN6I_MIPI_CSI_AO_FMT_JPEG
+	{
+		.pixelformat	= V4L2_PIX_FMT_JPEG,
+		.mbus_code	= MEDIA_BUS_FMT_JPEG_1X8,
+		.input_fmt	= CSI_INPUT_FORMAT_RAW,
+		.output_fmt	= CSI_FIELD_RAW_8,
+		.output_fmt_frame = CSI_FRAME_RAW_8,
+		.mipi_dt	= MIPI_RAW8,
+		.bpp		= 8,
+		.planes		= 1,
+		.hsize_mul	= 1,
+	},
+#endif
+};
+
+const struct sun6i_csi_format *sun6i_csi_find_format(u32 pixformat,
+						     u32 mbus_code)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(sun6i_csi_formats); i++) {
+		const struct sun6i_csi_format *fmt = &sun6i_csi_formats[i];
+
+		if (fmt->pixelformat == pixformat &&
+		    (!mbus_code || fmt->mbus_code == mbus_code))
+			return fmt;
+	}
+
+	return NULL;
+}
+
+u32 sun6i_csi_enum_pixformat(unsigned int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(sun6i_csi_formats); i++) {
+		if (i && sun6i_csi_formats[i].pixelformat ==
+			 sun6i_csi_formats[i - 1].pixelformat)
+			continue;
+		if (!index--)
+			return sun6i_csi_formats[i].pixelformat;
+	}
+
+	return 0;
+}
+
 bool sun6i_csi_is_format_supported(struct sun6i_csi *csi,
 				   u32 pixformat, u32 mbus_code)
 {
 	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	const struct sun6i_csi_format *fmt;
+
+	fmt = sun6i_csi_find_format(pixformat, mbus_code);
+	if (!fmt) {
+		dev_dbg(sdev->dev, "Unsupported pixformat 0x%x with mbus code 0x%x\n",
+			pixformat, mbus_code);
+		return false;
+	}
 
 	if (csi->v4l2_ep.bus_type == V4L2_MBUS_CSI2_DPHY) {
 		if(!sdev->clk_dphy){
@@ -54,127 +267,59 @@ bool sun6i_csi_is_format_supported(struct sun6i_csi *csi,
 	 * 8bit and 16bit bus width.
 	 * Identify the media bus format from device tree.
 	 */
-	if ((sdev->csi.v4l2_ep.bus_type == V4L2_MBUS_PARALLEL
-	     || sdev->csi.v4l2_ep.bus_type == V4L2_MBUS_BT656)
-	     && sdev->csi.v4l2_ep.bus.parallel.bus_width == 16) {
-		switch (pixformat) {
-		case V4L2_PIX_FMT_NV12:
-		case V4L2_PIX_FMT_NV21:
-		case V4L2_PIX_FMT_NV16:
-		case V4L2_PIX_FMT_NV61:
-		case V4L2_PIX_FMT_YUV420:
-		case V4L2_PIX_FMT_YVU420:
-		case V4L2_PIX_FMT_YUV422P:
-			switch (mbus_code) {
-			case MEDIA_BUS_FMT_UYVY8_1X16:
-			case MEDIA_BUS_FMT_VYUY8_1X16:
-			case MEDIA_BUS_FMT_YUYV8_1X16:
-			case MEDIA_BUS_FMT_YVYU8_1X16:
-				return true;
-			default:
-				dev_dbg(sdev->dev, "Unsupported mbus code: 0x%x H8\n",
-					mbus_code);
-				break;
-			}
-			break;
-		default:
-			dev_dbg(sdev->dev, "Unsupported pixformat: 0x%x H9\n",
-				pixformat);
-			break;
-		}
-		return false;
+	return fmt->bus16 ==
+	       ((csi->v4l2_ep.bus_type == V4L2_MBUS_PARALLEL ||
+		 csi->v4l2_ep.bus_type == V4L2_MBUS_BT656) &&
+		csi->v4l2_ep.bus.parallel.bus_width == 16);
+}
+
+int sun6i_csi_set_power(struct sun6i_csi *csi, bool enable)
+{
+	struct device *dev = csi->dev;
+	int ret;
+
+	if (!enable) {
+		pm_runtime_mark_last_busy(dev);
+		pm_runtime_put_autosuspend(dev);
+		return 0;
 	}
 
-	switch (pixformat) {
-	case V4L2_PIX_FMT_SBGGR8:
-		return (mbus_code == MEDIA_BUS_FMT_SBGGR8_1X8);
-	case V4L2_PIX_FMT_SGBRG8:
-		return (mbus_code == MEDIA_BUS_FMT_SGBRG8_1X8);
-	case V4L2_PIX_FMT_SGRBG8:
-		return (mbus_code == MEDIA_BUS_FMT_SGRBG8_1X8);
-	case V4L2_PIX_FMT_SRGGB8:
-		return (mbus_code == MEDIA_BUS_FMT_SRGGB8_1X8);
-	case V4L2_PIX_FMT_SBGGR10:
-		return (mbus_code == MEDIA_BUS_FMT_SBGGR10_1X10);
-	case V4L2_PIX_FMT_SGBRG10:
-		return (mbus_code == MEDIA_BUS_FMT_SGBRG10_1X10);
-	case V4L2_PIX_FMT_SGRBG10:
-		return (mbus_code == MEDIA_BUS_FMT_SGRBG10_1X10);
-	case V4L2_PIX_FMT_SRGGB10:
-		return (mbus_code == MEDIA_BUS_FMT_SRGGB10_1X10);
-	case V4L2_PIX_FMT_SBGGR12:
-		return (mbus_code == MEDIA_BUS_FMT_SBGGR12_1X12);
-	case V4L2_PIX_FMT_SGBRG12:
-		return (mbus_code == MEDIA_BUS_FMT_SGBRG12_1X12);
-	case V4L2_PIX_FMT_SGRBG12:
-		return (mbus_code == MEDIA_BUS_FMT_SGRBG12_1X12);
-	case V4L2_PIX_FMT_SRGGB12:
-		return (mbus_code == MEDIA_BUS_FMT_SRGGB12_1X12);
-
-	case V4L2_PIX_FMT_YUYV:
-		return (mbus_code == MEDIA_BUS_FMT_YUYV8_2X8);
-	case V4L2_PIX_FMT_YVYU:
-		return (mbus_code == MEDIA_BUS_FMT_YVYU8_2X8);
-	case V4L2_PIX_FMT_UYVY:
-		return (mbus_code == MEDIA_BUS_FMT_UYVY8_2X8);
-	case V4L2_PIX_FMT_VYUY:
-		return (mbus_code == MEDIA_BUS_FMT_VYUY8_2X8);
-
-	case V4L2_PIX_FMT_NV12:
-	case V4L2_PIX_FMT_NV21:
-	case V4L2_PIX_FMT_NV16:
-	case V4L2_PIX_FMT_NV61:
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-	case V4L2_PIX_FMT_YUV422P:
-		switch (mbus_code) {
-		case MEDIA_BUS_FMT_UYVY8_2X8:
-		case MEDIA_BUS_FMT_VYUY8_2X8:
-		case MEDIA_BUS_FMT_YUYV8_2X8:
-		case MEDIA_BUS_FMT_YVYU8_2X8:
-			return true;
-		default:
-			dev_dbg(sdev->dev, "Unsupported mbus code: 0x%x H7\n",
-				mbus_code);
-			break;
-		}
-		break;
+	ret = pm_runtime_get_sync(dev);
+	if (ret < 0) {
+		pm_runtime_put_noidle(dev);
+		return ret;
+	}
 
-	case V4L2_PIX_FMT_RGB565:
-		return (mbus_code == MEDIA_BUS_FMT_RGB565_2X8_LE);
-	case V4L2_PIX_FMT_RGB565X:
-		return (mbus_code == MEDIA_BUS_FMT_RGB565_2X8_BE);
+	return 0;
+}
 
-	case V4L2_PIX_FMT_JPEG:
-		return (mbus_code == MEDIA_BUS_FMT_JPEG_1X8);
+/*
+ * The bus reset stays deasserted from probe to remove, so the registers
+ * and the cached configuration survive a runtime suspend and resuming
+ * only costs the clocks.
+ */
+static int __maybe_unused sun6i_csi_runtime_suspend(struct device *dev)
+{
+	struct sun6i_csi_dev *sdev = dev_get_drvdata(dev);
 
-	default:
-		dev_dbg(sdev->dev, "Unsupported pixformat: 0x%x H10\n", pixformat);
-		break;
-	}
+	sun6i_mipi_set_state(&sdev->csi, sun6i_csi_mipi_stopped());
 
-	return false;
+	regmap_update_bits(sdev->regmap, CSI_EN_REG, CSI_EN_CSI_EN, 0);
+
+	clk_disable_unprepare(sdev->clk_ram);
+	if (of_device_is_compatible(dev->of_node, "allwinner,sun50i-a64-csi"))
+		clk_rate_exclusive_put(sdev->clk_mod);
+	clk_disable_unprepare(sdev->clk_mod);
+
+	return 0;
 }
 
-int sun6i_csi_set_power(struct sun6i_csi *csi, bool enable)
+static int __maybe_unused sun6i_csi_runtime_resume(struct device *dev)
 {
-	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
-	struct device *dev = sdev->dev;
+	struct sun6i_csi_dev *sdev = dev_get_drvdata(dev);
 	struct regmap *regmap = sdev->regmap;
 	int ret;
 
-	if (!enable) {
-		regmap_update_bits(regmap, CSI_EN_REG, CSI_EN_CSI_EN, 0);
-
-		clk_disable_unprepare(sdev->clk_ram);
-		if (of_device_is_compatible(dev->of_node,
-					    "allwinner,sun50i-a64-csi"))
-			clk_rate_exclusive_put(sdev->clk_mod);
-		clk_disable_unprepare(sdev->clk_mod);
-		reset_control_assert(sdev->rstc_bus);
-		return 0;
-	}
-
 	ret = clk_prepare_enable(sdev->clk_mod);
 	if (ret) {
 		dev_err(sdev->dev, "Enable csi clk err %d\n", ret);
@@ -190,18 +335,19 @@ int sun6i_csi_set_power(struct sun6i_csi *csi, bool enable)
 		goto clk_mod_disable;
 	}
 
-	ret = reset_control_deassert(sdev->rstc_bus);
-	if (ret) {
-		dev_err(sdev->dev, "reset err %d\n", ret);
-		goto clk_ram_disable;
-	}
+	/* Nothing may be left running from the last stream */
+	regmap_write(regmap, CSI_CAP_REG, 0);
+	regmap_write(regmap, CSI_CH_INT_EN_REG, 0);
+	regmap_write(regmap, CSI_CH_INT_STA_REG, 0xFF);
+	regmap_write(regmap,
+		     CSI_CH_REG(CSI_CH_INT_EN_REG, SUN6I_META_CSI_CH), 0);
+	regmap_write(regmap,
+		     CSI_CH_REG(CSI_CH_INT_STA_REG, SUN6I_META_CSI_CH), 0xFF);
 
 	regmap_update_bits(regmap, CSI_EN_REG, CSI_EN_CSI_EN, CSI_EN_CSI_EN);
 
 	return 0;
 
-clk_ram_disable:
-	clk_disable_unprepare(sdev->clk_ram);
 clk_mod_disable:
 	if (of_device_is_compatible(dev->of_node, "allwinner,sun50i-a64-csi"))
 		clk_rate_exclusive_put(sdev->clk_mod);
@@ -209,201 +355,6 @@ clk_mod_disable:
 	return ret;
 }
 
-static enum csi_input_fmt get_csi_input_format(struct sun6i_csi_dev *sdev,
-					       u32 mbus_code, u32 pixformat)
-{
-    dev_warn(sdev->dev, "%s(%d): csi1: \n", __func__, __LINE__);
-	/* non-YUV */
-	if ((mbus_code & 0xF000) != 0x2000)
-    {
-        dev_warn(sdev->dev, "%s(%d): csi1: Non YUV format\n", __func__, __LINE__);
-		return CSI_INPUT_FORMAT_RAW;
-    }
-   // return CSI_INPUT_FORMAT_YUV422;
-    
-	switch (pixformat) {
-	case V4L2_PIX_FMT_YUYV:
-	case V4L2_PIX_FMT_YVYU:
-	case V4L2_PIX_FMT_UYVY:
-	case V4L2_PIX_FMT_VYUY:
-        dev_warn(sdev->dev, "%s(%d): csi1: Raw pix\n", __func__, __LINE__);
-		return CSI_INPUT_FORMAT_RAW;
-	default:
-		break;
-	}
-
-	/* not support YUV420 input format yet */
-    dev_warn(sdev->dev, "%s(%d): csi1: Select YUYV422 as default \n", __func__, __LINE__);
-	dev_dbg(sdev->dev, "Select YUV422 as default input format of CSI.\n");
-	return CSI_INPUT_FORMAT_YUV422;
-}
-
-static enum csi_output_fmt get_csi_output_format(struct sun6i_csi_dev *sdev,
-						 u32 pixformat, u32 field)
-{
-	bool buf_interlaced = false;
-dev_warn(sdev->dev, "%s(%d): csi1 \n", __func__, __LINE__);
-	if (field == V4L2_FIELD_INTERLACED
-	    || field == V4L2_FIELD_INTERLACED_TB
-	    || field == V4L2_FIELD_INTERLACED_BT)
-		buf_interlaced = true;
-
-	switch (pixformat) {
-	case V4L2_PIX_FMT_SBGGR8:
-	case V4L2_PIX_FMT_SGBRG8:
-	case V4L2_PIX_FMT_SGRBG8:
-	case V4L2_PIX_FMT_SRGGB8:
-        
-		return buf_interlaced ? CSI_FRAME_RAW_8 : CSI_FIELD_RAW_8;
-	case V4L2_PIX_FMT_SBGGR10:
-	case V4L2_PIX_FMT_SGBRG10:
-	case V4L2_PIX_FMT_SGRBG10:
-	case V4L2_PIX_FMT_SRGGB10:
-		return buf_interlaced ? CSI_FRAME_RAW_10 : CSI_FIELD_RAW_10;
-	case V4L2_PIX_FMT_SBGGR12:
-	case V4L2_PIX_FMT_SGBRG12:
-	case V4L2_PIX_FMT_SGRBG12:
-	case V4L2_PIX_FMT_SRGGB12:
-		return buf_interlaced ? CSI_FRAME_RAW_12 : CSI_FIELD_RAW_12;
-
-	case V4L2_PIX_FMT_YUYV:
-	case V4L2_PIX_FMT_YVYU:
-	case V4L2_PIX_FMT_UYVY:
-	case V4L2_PIX_FMT_VYUY:
-        dev_warn(sdev->dev, "%s(%d): csi1: PIXFMT Raw8 for UYUV and friends\n", __func__, __LINE__);
-		return buf_interlaced ? CSI_FRAME_RAW_8 : CSI_FIELD_RAW_8; // Other way?
-        //return CSI_FRAME_RAW_8;
-		//return buf_interlaced ? CSI_FRAME_RAW_8 : CSI_FIELD_PLANAR_YUV422;
-
-	case V4L2_PIX_FMT_NV12:
-	case V4L2_PIX_FMT_NV21:
-        dev_warn(sdev->dev, "%s(%d): csi1: PIXFMT CSI_FIELD_UV_CB_YUV420 for NV12/NV21\n", __func__, __LINE__);
-		return buf_interlaced ? CSI_FRAME_UV_CB_YUV420 :
-					CSI_FIELD_UV_CB_YUV420;
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-        dev_warn(sdev->dev, "%s(%d): csi1: PIXFMT CSI_FIELD_PLANAR_YUV420 for YUV420/YVU420\n", __func__, __LINE__);
-		return buf_interlaced ? CSI_FRAME_PLANAR_YUV420 :
-					CSI_FIELD_PLANAR_YUV420;
-	case V4L2_PIX_FMT_NV16:
-	case V4L2_PIX_FMT_NV61:
-        dev_warn(sdev->dev, "%s(%d): csi1: PIXFMT CSI_FIELD_UV_CB_YUV422 for NV16/NV61\n", __func__, __LINE__);
-		return buf_interlaced ? CSI_FRAME_UV_CB_YUV422 :
-					CSI_FIELD_UV_CB_YUV422;
-	case V4L2_PIX_FMT_YUV422P:
-        dev_warn(sdev->dev, "%s(%d): csi1: PIXFMT CSI_FRAME_PLANAR_YUV422 for YUV422P\n", __func__, __LINE__);
-		return buf_interlaced ? CSI_FRAME_PLANAR_YUV422 :
-					CSI_FIELD_PLANAR_YUV422;
-
-	case V4L2_PIX_FMT_RGB565:
-	case V4L2_PIX_FMT_RGB565X:
-		return buf_interlaced ? CSI_FRAME_RGB565 : CSI_FIELD_RGB565;
-
-	case V4L2_PIX_FMT_JPEG:
-		return buf_interlaced ? CSI_FRAME_RAW_8 : CSI_FIELD_RAW_8;
-
-	default:
-        dev_warn(sdev->dev, "%s(%d): csi1: Unsupported pixformat: 0x%x H1 \n", __func__, __LINE__, pixformat);
-		dev_warn(sdev->dev, "Unsupported pixformat: 0x%x H1\n", pixformat);
-		break;
-	}
-
-	return CSI_FIELD_RAW_8;
-}
-
-static enum csi_input_seq get_csi_input_seq(struct sun6i_csi_dev *sdev,
-					    u32 mbus_code, u32 pixformat)
-{
-    dev_warn(sdev->dev, "%s(%d): csi1\n", __func__, __LINE__);
-	/* Input sequence does not apply to non-YUV formats */
-	if ((mbus_code & 0xF000) != 0x2000)
-    {
-        dev_warn(sdev->dev, "%s(%d): csi1: Doesn't apply to non-yuv\n", __func__, __LINE__);
-		return 0;
-    }
-
-    return CSI_INPUT_SEQ_UYVY;
-    
-	switch (pixformat) {
-	case V4L2_PIX_FMT_NV12:
-	case V4L2_PIX_FMT_NV16:
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YUV422P:
-		switch (mbus_code) {
-		case MEDIA_BUS_FMT_UYVY8_2X8:
-		case MEDIA_BUS_FMT_UYVY8_1X16:
-            dev_warn(sdev->dev, "%s(%d): csi1: UYVY \n", __func__, __LINE__);
-			return CSI_INPUT_SEQ_UYVY;
-		case MEDIA_BUS_FMT_VYUY8_2X8:
-		case MEDIA_BUS_FMT_VYUY8_1X16:
-            dev_warn(sdev->dev, "%s(%d): csi1: VYUY\n", __func__, __LINE__);
-			return CSI_INPUT_SEQ_VYUY;
-		case MEDIA_BUS_FMT_YUYV8_2X8:
-		case MEDIA_BUS_FMT_YUYV8_1X16:
-            dev_warn(sdev->dev, "%s(%d): csi1: YUYV\n", __func__, __LINE__);
-			return CSI_INPUT_SEQ_YUYV;
-		case MEDIA_BUS_FMT_YVYU8_1X16:
-		case MEDIA_BUS_FMT_YVYU8_2X8:
-            dev_warn(sdev->dev, "%s(%d): csi1: YVYU\n", __func__, __LINE__);
-			return CSI_INPUT_SEQ_YVYU;
-		default:
-            dev_warn(sdev->dev, "%s(%d): csi1: YUV422 Unsupported\n", __func__, __LINE__);
-			dev_warn(sdev->dev, "Unsupported mbus code: 0x%x H2\n",
-				 mbus_code);
-			break;
-		}
-		break;
-	case V4L2_PIX_FMT_NV21:
-	case V4L2_PIX_FMT_NV61:
-	case V4L2_PIX_FMT_YVU420:
-		switch (mbus_code) {
-		case MEDIA_BUS_FMT_UYVY8_2X8:
-		case MEDIA_BUS_FMT_UYVY8_1X16:
-            dev_warn(sdev->dev, "%s(%d): csi1: NV2161/UYVY\n", __func__, __LINE__);
-			return CSI_INPUT_SEQ_VYUY;
-		case MEDIA_BUS_FMT_VYUY8_2X8:
-		case MEDIA_BUS_FMT_VYUY8_1X16:
-            dev_warn(sdev->dev, "%s(%d): csi1: NV2161/VYUY\n", __func__, __LINE__);
-			return CSI_INPUT_SEQ_UYVY;
-		case MEDIA_BUS_FMT_YUYV8_2X8:
-		case MEDIA_BUS_FMT_YUYV8_1X16:
-            dev_warn(sdev->dev, "%s(%d): csi1: NV2161/YUYV\n", __func__, __LINE__);
-			return CSI_INPUT_SEQ_YVYU;
-		case MEDIA_BUS_FMT_YVYU8_1X16:
-		case MEDIA_BUS_FMT_YVYU8_2X8:
-            dev_warn(sdev->dev, "%s(%d): csi1: NV2161/YVYU\n", __func__, __LINE__);
-			return CSI_INPUT_SEQ_YUYV;
-		default:
-            dev_warn(sdev->dev, "%s(%d): csi1: NV2161 Unsupported H3\n", __func__, __LINE__);
-			dev_warn(sdev->dev, "Unsupported mbus code: 0x%xH3\n",
-				 mbus_code);
-			break;
-		}
-		break;
-
-	case V4L2_PIX_FMT_YUYV:
-        dev_warn(sdev->dev, "%s(%d): csi1: V4L2_PIX_FMT_YUYV\n", __func__, __LINE__);
-		return CSI_INPUT_SEQ_YUYV;
-    case V4L2_PIX_FMT_YVYU:
-        dev_warn(sdev->dev, "%s(%d): csi1: V4L2_PIX_FMT_YVYU\n", __func__, __LINE__);
-		return CSI_INPUT_SEQ_YVYU;
-    case V4L2_PIX_FMT_UYVY:
-        dev_warn(sdev->dev, "%s(%d): csi1: V4L2_PIX_FMT_UYVY\n", __func__, __LINE__);
-		return CSI_INPUT_SEQ_UYVY;
-    case V4L2_PIX_FMT_VYUY:
-        dev_warn(sdev->dev, "%s(%d): csi1: V4L2_PIX_FMT_VYUY\n", __func__, __LINE__);
-		return CSI_INPUT_SEQ_VYUY;
-
-	default:
-        dev_warn(sdev->dev, "%s(%d): csi1: Unsupported pixformat\n", __func__, __LINE__);
-		dev_warn(sdev->dev, "Unsupported pixformat: 0x%x, defaulting to UYVY H4\n",
-			 pixformat);
-		break;
-	}
-
-	return CSI_INPUT_SEQ_UYVY;
-}
-
 static void sun6i_csi_setup_bus(struct sun6i_csi_dev *sdev)
 {
 	struct v4l2_fwnode_endpoint *endpoint = &sdev->csi.v4l2_ep;
@@ -501,8 +452,14 @@ static void sun6i_csi_setup_bus(struct sun6i_csi_dev *sdev)
 static void sun6i_csi_set_format(struct sun6i_csi_dev *sdev)
 {
 	struct sun6i_csi *csi = &sdev->csi;
+	const struct sun6i_csi_format *fmt = csi->fmt;
+	bool buf_interlaced = false;
 	u32 cfg;
-	u32 val;
+
+	if (csi->config.field == V4L2_FIELD_INTERLACED
+	    || csi->config.field == V4L2_FIELD_INTERLACED_TB
+	    || csi->config.field == V4L2_FIELD_INTERLACED_BT)
+		buf_interlaced = true;
 
 	regmap_read(sdev->regmap, CSI_CH_CFG_REG, &cfg);
 
@@ -511,103 +468,66 @@ static void sun6i_csi_set_format(struct sun6i_csi_dev *sdev)
 		 CSI_CH_CFG_HFLIP_EN | CSI_CH_CFG_FIELD_SEL_MASK |
 		 CSI_CH_CFG_INPUT_SEQ_MASK);
 
-	val = get_csi_input_format(sdev, csi->config.code,
-				   csi->config.pixelformat);
-	cfg |= CSI_CH_CFG_INPUT_FMT(val);
-
-	val = get_csi_output_format(sdev, csi->config.pixelformat,
-				    csi->config.field);
-	cfg |= CSI_CH_CFG_OUTPUT_FMT(val);
-
-	val = get_csi_input_seq(sdev, csi->config.code,
-				csi->config.pixelformat);
-	cfg |= CSI_CH_CFG_INPUT_SEQ(val);
+	cfg |= CSI_CH_CFG_INPUT_FMT(fmt->input_fmt);
+	cfg |= CSI_CH_CFG_OUTPUT_FMT(buf_interlaced ? fmt->output_fmt_frame :
+						      fmt->output_fmt);
+	cfg |= CSI_CH_CFG_INPUT_SEQ(fmt->input_seq);
 
 	if (csi->config.field == V4L2_FIELD_TOP)
-    {
 		cfg |= CSI_CH_CFG_FIELD_SEL_FIELD0;
-        dev_warn(sdev->dev, "V4L2_FIELD_TOP\n");
-    }
 	else if (csi->config.field == V4L2_FIELD_BOTTOM)
-    {
 		cfg |= CSI_CH_CFG_FIELD_SEL_FIELD1;
-        dev_warn(sdev->dev, "V4L2_FIELD_BOTTOM\n");
-    }
 	else
-    {
 		cfg |= CSI_CH_CFG_FIELD_SEL_BOTH;
-        
-        dev_warn(sdev->dev, "V4L2_FIELD_BOTH\n");
-    }
-    
+
 	regmap_write(sdev->regmap, CSI_CH_CFG_REG, cfg);
 }
 
 static void sun6i_csi_set_window(struct sun6i_csi_dev *sdev)
 {
 	struct sun6i_csi_config *config = &sdev->csi.config;
+	const struct sun6i_csi_format *fmt = sdev->csi.fmt;
 	u32 bytesperline_y;
 	u32 bytesperline_c;
 	int *planar_offset = sdev->planar_offset;
 	u32 width = config->width;
 	u32 height = config->height;
-	u32 hor_len = width;
-
-	switch (config->pixelformat) {
-	case V4L2_PIX_FMT_YUYV:
-	case V4L2_PIX_FMT_YVYU:
-	case V4L2_PIX_FMT_UYVY:
-	case V4L2_PIX_FMT_VYUY:
-		dev_dbg(sdev->dev,
-			"Horizontal length should be 2 times of width for packed YUV formats!\n");
-		hor_len = width * 2;
-		break;
-	default:
-		break;
-	}
 
+	/* The window is cut from the source frame before quarter scaling */
 	regmap_write(sdev->regmap, CSI_CH_HSIZE_REG,
-		     CSI_CH_HSIZE_HOR_LEN(hor_len) |
-		     CSI_CH_HSIZE_HOR_START(0));
+		     CSI_CH_HSIZE_HOR_LEN(config->window.width *
+					  fmt->hsize_mul) |
+		     CSI_CH_HSIZE_HOR_START(config->window.left *
+					    fmt->hsize_mul));
 	regmap_write(sdev->regmap, CSI_CH_VSIZE_REG,
-		     CSI_CH_VSIZE_VER_LEN(height) |
-		     CSI_CH_VSIZE_VER_START(0));
+		     CSI_CH_VSIZE_VER_LEN(config->window.height) |
+		     CSI_CH_VSIZE_VER_START(config->window.top));
+	regmap_write(sdev->regmap, CSI_CH_SCALE_REG,
+		     config->quarter ? CSI_CH_SCALE_QUART_EN : 0);
 
 	planar_offset[0] = 0;
-	switch (config->pixelformat) {
-	case V4L2_PIX_FMT_NV12:
-	case V4L2_PIX_FMT_NV21:
-	case V4L2_PIX_FMT_NV16:
-	case V4L2_PIX_FMT_NV61:
-		bytesperline_y = width;
-		bytesperline_c = width;
-		planar_offset[1] = bytesperline_y * height;
-		planar_offset[2] = -1;
+	planar_offset[1] = -1;
+	planar_offset[2] = -1;
+	switch (fmt->planes) {
+	case 1:
+		bytesperline_y = width * fmt->bpp / 8;
+		/* Only YUV lines are padded to the requested stride */
+		if (fmt->yuv)
+			bytesperline_y = max(config->bytesperline,
+					     bytesperline_y);
+		bytesperline_c = 0;
 		break;
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-		bytesperline_y = width;
-		bytesperline_c = width / 2;
+	case 2:
+		bytesperline_y = max(config->bytesperline, width);
+		bytesperline_c = bytesperline_y;
 		planar_offset[1] = bytesperline_y * height;
-		planar_offset[2] = planar_offset[1] +
-				bytesperline_c * height / 2;
 		break;
-	case V4L2_PIX_FMT_YUV422P:
-		bytesperline_y = width;
-		bytesperline_c = width / 2;
+	default:
+		bytesperline_y = max(config->bytesperline, width);
+		bytesperline_c = bytesperline_y / 2;
 		planar_offset[1] = bytesperline_y * height;
 		planar_offset[2] = planar_offset[1] +
-				bytesperline_c * height;
-		break;
-	default: /* raw */
-		dev_dbg(sdev->dev,
-			"Calculating pixelformat(0x%x)'s bytesperline as a packed format\n",
-			config->pixelformat);
-		bytesperline_y = (sun6i_csi_get_bpp(config->pixelformat) *
-				  config->width) / 8;
-		bytesperline_c = 0;
-		planar_offset[1] = -1;
-		planar_offset[2] = -1;
+				bytesperline_c * height / fmt->vdiv;
 		break;
 	}
 
@@ -620,31 +540,99 @@ int sun6i_csi_update_config(struct sun6i_csi *csi,
 			    struct sun6i_csi_config *config)
 {
 	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	struct sun6i_csi_config *old = &sdev->applied;
+	bool valid = sdev->applied_valid;
+	const struct sun6i_csi_format *fmt;
 
 	if (!config)
 		return -EINVAL;
 
+	fmt = sun6i_csi_find_format(config->pixelformat, config->code);
+	if (!fmt)
+		return -EINVAL;
+
+	config->lanes = 0;
+	config->lane_bps = 0;
+	config->lane_bps_src = NULL;
+	if (csi->v4l2_ep.bus_type == V4L2_MBUS_CSI2_DPHY)
+		sun6i_mipi_negotiate(csi, fmt, config);
+
 	memcpy(&csi->config, config, sizeof(csi->config));
+	csi->fmt = fmt;
+
+	/*
+	 * A DPHY that was switched off has been through its analog exit and
+	 * needs the full parameter setup again. An idle one kept it, but
+	 * not if the sensor now sends on other lanes or at another rate.
+	 */
+	if (!valid || old->field != config->field ||
+	    old->code != config->code ||
+	    old->lanes != config->lanes ||
+	    old->lane_bps != config->lane_bps ||
+	    (csi->v4l2_ep.bus_type == V4L2_MBUS_CSI2_DPHY &&
+	     sdev->mipi_state == SUN6I_MIPI_OFF)) {
+		/* The DPHY can't be reprogrammed while it is up */
+		sun6i_mipi_set_state(csi, SUN6I_MIPI_OFF);
+		sun6i_csi_setup_bus(sdev);
+	}
+
+	if (!valid || old->field != config->field ||
+	    old->code != config->code ||
+	    old->pixelformat != config->pixelformat)
+		sun6i_csi_set_format(sdev);
+
+	if (!valid || old->pixelformat != config->pixelformat ||
+	    old->width != config->width || old->height != config->height ||
+	    old->bytesperline != config->bytesperline ||
+	    !v4l2_rect_equal(&old->window, &config->window) ||
+	    old->quarter != config->quarter)
+		sun6i_csi_set_window(sdev);
 
-	sun6i_csi_setup_bus(sdev);
-	sun6i_csi_set_format(sdev);
-	sun6i_csi_set_window(sdev);
+	sdev->applied = *config;
+	sdev->applied_valid = true;
 
 	return 0;
 }
 
-void sun6i_csi_update_buf_addr(struct sun6i_csi *csi, dma_addr_t addr)
+void sun6i_csi_update_buf_addr(struct sun6i_csi *csi, const dma_addr_t *addr,
+			       unsigned int num_planes)
 {
 	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	static const unsigned int bufa_reg[SUN6I_CSI_MAX_PLANES] = {
+		CSI_CH_F0_BUFA_REG, CSI_CH_F1_BUFA_REG, CSI_CH_F2_BUFA_REG,
+	};
+	unsigned int i;
+
+	if (num_planes > 1) {
+		for (i = 0; i < num_planes && i < SUN6I_CSI_MAX_PLANES; i++)
+			regmap_write(sdev->regmap, bufa_reg[i], addr[i] >> 2);
+		return;
+	}
 
 	regmap_write(sdev->regmap, CSI_CH_F0_BUFA_REG,
-		     (addr + sdev->planar_offset[0]) >> 2);
+		     (addr[0] + sdev->planar_offset[0]) >> 2);
 	if (sdev->planar_offset[1] != -1)
 		regmap_write(sdev->regmap, CSI_CH_F1_BUFA_REG,
-			     (addr + sdev->planar_offset[1]) >> 2);
+			     (addr[0] + sdev->planar_offset[1]) >> 2);
 	if (sdev->planar_offset[2] != -1)
 		regmap_write(sdev->regmap, CSI_CH_F2_BUFA_REG,
-			     (addr + sdev->planar_offset[2]) >> 2);
+			     (addr[0] + sdev->planar_offset[2]) >> 2);
+}
+
+void sun6i_csi_set_capture(struct sun6i_csi *csi, bool enable)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+
+	regmap_update_bits(sdev->regmap, CSI_CAP_REG, CSI_CAP_CH0_VCAP_ON,
+			   enable ? CSI_CAP_CH0_VCAP_ON : 0);
+}
+
+void sun6i_csi_set_fps_ds(struct sun6i_csi *csi, bool enable)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+
+	regmap_update_bits(sdev->regmap, CSI_IF_CFG_REG, CSI_IF_CFG_FPS_DS_EN,
+			   enable ? CSI_IF_CFG_FPS_DS_EN : 0);
 }
 
 void sun6i_csi_set_stream(struct sun6i_csi *csi, bool enable)
@@ -652,17 +640,28 @@ void sun6i_csi_set_stream(struct sun6i_csi *csi, bool enable)
 	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
 	struct regmap *regmap = sdev->regmap;
 
+	trace_sun6i_csi_stream(sdev->dev, enable);
+
 	if (!enable) {
-		if (csi->v4l2_ep.bus_type == V4L2_MBUS_CSI2_DPHY) {
-			sun6i_mipi_set_stream(csi, 0);
-		}
-		regmap_update_bits(regmap, CSI_CAP_REG, CSI_CAP_CH0_VCAP_ON, 0);
+		/*
+		 * On a warm restart only VCAP_ON is toggled. Power off or a bus
+		 * reconfiguration in update_config stops the receiver later.
+		 */
+		if (!warm_restart)
+			sun6i_mipi_set_state(csi, sun6i_csi_mipi_stopped());
+		sun6i_csi_set_capture(csi, false);
 		regmap_write(regmap, CSI_CH_INT_EN_REG, 0);
+		/*
+		 * The video buffer ring is not locked against the ISR or its
+		 * thread, this waits for both.
+		 */
+		synchronize_irq(sdev->irq);
 		return;
 	}
 
 	regmap_write(regmap, CSI_CH_INT_STA_REG, 0xFF);
 	regmap_write(regmap, CSI_CH_INT_EN_REG,
+		     CSI_CH_INT_EN_VS_INT_EN |
 		     CSI_CH_INT_EN_HB_OF_INT_EN |
 		     CSI_CH_INT_EN_FIFO2_OF_INT_EN |
 		     CSI_CH_INT_EN_FIFO1_OF_INT_EN |
@@ -670,11 +669,76 @@ void sun6i_csi_set_stream(struct sun6i_csi *csi, bool enable)
 		     CSI_CH_INT_EN_FD_INT_EN |
 		     CSI_CH_INT_EN_CD_INT_EN);
 
-	regmap_update_bits(regmap, CSI_CAP_REG, CSI_CAP_CH0_VCAP_ON,
-			   CSI_CAP_CH0_VCAP_ON);
-	if (csi->v4l2_ep.bus_type == V4L2_MBUS_CSI2_DPHY) {
-		sun6i_mipi_set_stream(csi, 1);
+	sun6i_csi_set_capture(csi, true);
+	if (csi->v4l2_ep.bus_type == V4L2_MBUS_CSI2_DPHY)
+		sun6i_mipi_set_state(csi, SUN6I_MIPI_ON);
+}
+
+void sun6i_csi_meta_set_buf_addr(struct sun6i_csi *csi, dma_addr_t addr)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+
+	regmap_write(sdev->regmap,
+		     CSI_CH_REG(CSI_CH_F0_BUFA_REG, SUN6I_META_CSI_CH),
+		     addr >> 2);
+}
+
+void sun6i_csi_meta_set_stream(struct sun6i_csi *csi, bool enable)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	struct sun6i_meta *meta = &csi->meta;
+	struct regmap *regmap = sdev->regmap;
+	unsigned int ch = SUN6I_META_CSI_CH;
+
+	if (!enable) {
+		regmap_update_bits(regmap, CSI_CAP_REG,
+				   CSI_CAP_CH_VCAP_ON(ch), 0);
+		regmap_write(regmap, CSI_CH_REG(CSI_CH_INT_EN_REG, ch), 0);
+		/* The metadata ring is walked by the ISR and its thread */
+		synchronize_irq(sdev->irq);
+		return;
 	}
+
+	/* Packets are stored as they come, one byte per pixel */
+	regmap_write(regmap, CSI_CH_REG(CSI_CH_CFG_REG, ch),
+		     CSI_CH_CFG_INPUT_FMT(CSI_INPUT_FORMAT_RAW) |
+		     CSI_CH_CFG_OUTPUT_FMT(CSI_FRAME_RAW_8));
+	regmap_write(regmap, CSI_CH_REG(CSI_CH_HSIZE_REG, ch),
+		     CSI_CH_HSIZE_HOR_LEN(meta->bytesperline) |
+		     CSI_CH_HSIZE_HOR_START(0));
+	regmap_write(regmap, CSI_CH_REG(CSI_CH_VSIZE_REG, ch),
+		     CSI_CH_VSIZE_VER_LEN(meta->lines) |
+		     CSI_CH_VSIZE_VER_START(0));
+	regmap_write(regmap, CSI_CH_REG(CSI_CH_BUF_LEN_REG, ch),
+		     CSI_CH_BUF_LEN_BUF_LEN_Y(meta->bytesperline));
+
+	regmap_write(regmap, CSI_CH_REG(CSI_CH_INT_STA_REG, ch), 0xFF);
+	regmap_write(regmap, CSI_CH_REG(CSI_CH_INT_EN_REG, ch),
+		     CSI_CH_INT_EN_FD_INT_EN);
+	regmap_update_bits(regmap, CSI_CAP_REG, CSI_CAP_CH_VCAP_ON(ch),
+			   CSI_CAP_CH_VCAP_ON(ch));
+}
+
+int sun6i_csi_check_bandwidth(struct sun6i_csi *csi, struct v4l2_subdev *sd,
+			      u32 pixformat,
+			      const struct v4l2_mbus_framefmt *mf)
+{
+	const struct sun6i_csi_format *fmt;
+
+	if (csi->v4l2_ep.bus_type != V4L2_MBUS_CSI2_DPHY)
+		return 0;
+
+	fmt = sun6i_csi_find_format(pixformat, mf->code);
+	if (!fmt)
+		return -EPIPE;
+
+	return sun6i_mipi_check_bandwidth(csi, sd, fmt, mf->width, mf->height);
+}
+
+void sun6i_csi_calibrate(struct sun6i_csi *csi)
+{
+	if (csi->v4l2_ep.bus_type == V4L2_MBUS_CSI2_DPHY)
+		sun6i_mipi_calibrate(csi);
 }
 
 /* -----------------------------------------------------------------------------
@@ -682,10 +746,10 @@ void sun6i_csi_set_stream(struct sun6i_csi *csi, bool enable)
  */
 static int sun6i_csi_link_entity(struct sun6i_csi *csi,
 				 struct media_entity *entity,
-				 struct fwnode_handle *fwnode)
+				 struct fwnode_handle *fwnode,
+				 struct media_pad *sink_pad)
 {
-	struct media_entity *sink;
-	struct media_pad *sink_pad;
+	struct media_entity *sink = sink_pad->entity;
 	int src_pad_index;
 	int ret;
 
@@ -698,9 +762,6 @@ static int sun6i_csi_link_entity(struct sun6i_csi *csi,
 
 	src_pad_index = ret;
 
-	sink = &csi->video.vdev.entity;
-	sink_pad = &csi->video.pad;
-
 	dev_dbg(csi->dev, "creating %s:%u -> %s:%u link\n",
 		entity->name, src_pad_index, sink->name, sink_pad->index);
 	ret = media_create_pad_link(entity, src_pad_index, sink,
@@ -731,10 +792,18 @@ static int sun6i_subdev_notify_complete(struct v4l2_async_notifier *notifier)
 	if (!sd)
 		return -EINVAL;
 
-	ret = sun6i_csi_link_entity(csi, &sd->entity, sd->fwnode);
+	ret = sun6i_csi_link_entity(csi, &sd->entity, sd->fwnode,
+				    &csi->video.pad);
 	if (ret < 0)
 		return ret;
 
+	if (csi->meta.registered) {
+		ret = sun6i_csi_link_entity(csi, &sd->entity, sd->fwnode,
+					    &csi->meta.pad);
+		if (ret < 0)
+			return ret;
+	}
+
 	ret = v4l2_device_register_subdev_nodes(&csi->v4l2_dev);
 	if (ret < 0)
 		return ret;
@@ -774,6 +843,7 @@ static void sun6i_csi_v4l2_cleanup(struct sun6i_csi *csi)
 	media_device_unregister(&csi->media_dev);
 	v4l2_async_notifier_unregister(&csi->notifier);
 	v4l2_async_notifier_cleanup(&csi->notifier);
+	sun6i_meta_cleanup(&csi->meta);
 	sun6i_video_cleanup(&csi->video);
 	v4l2_device_unregister(&csi->v4l2_dev);
 	v4l2_ctrl_handler_free(&csi->ctrl_handler);
@@ -787,6 +857,8 @@ static int sun6i_csi_v4l2_init(struct sun6i_csi *csi)
 	csi->media_dev.dev = csi->dev;
 	strscpy(csi->media_dev.model, "Allwinner Video Capture Device",
 		sizeof(csi->media_dev.model));
+	snprintf(csi->media_dev.bus_info, sizeof(csi->media_dev.bus_info),
+		 "platform:%s", dev_name(csi->dev));
 	csi->media_dev.hw_revision = 0;
 
 	media_device_init(&csi->media_dev);
@@ -819,16 +891,23 @@ static int sun6i_csi_v4l2_init(struct sun6i_csi *csi)
 	if (ret)
 		goto clean_video;
 
+	/* Needs the bus type from the endpoint */
+	ret = sun6i_meta_init(&csi->meta, csi, "sun6i-csi-meta");
+	if (ret)
+		goto clean_video;
+
 	csi->notifier.ops = &sun6i_csi_async_ops;
 
 	ret = v4l2_async_notifier_register(&csi->v4l2_dev, &csi->notifier);
 	if (ret) {
 		dev_err(csi->dev, "notifier registration failed\n");
-		goto clean_video;
+		goto clean_meta;
 	}
 
 	return 0;
 
+clean_meta:
+	sun6i_meta_cleanup(&csi->meta);
 clean_video:
 	sun6i_video_cleanup(&csi->video);
 unreg_v4l2:
@@ -845,41 +924,213 @@ clean_media:
 /* -----------------------------------------------------------------------------
  * Resources and IRQ
  */
-static irqreturn_t sun6i_csi_isr(int irq, void *dev_id)
+static void sun6i_csi_count_overflow(struct sun6i_csi_dev *sdev, u32 status)
+{
+	struct sun6i_csi_stats *stats = &sdev->csi.stats;
+
+	if (status & CSI_CH_INT_STA_FIFO0_OF_PD)
+		sun6i_csi_stats_inc(stats->fifo_of[0]);
+	if (status & CSI_CH_INT_STA_FIFO1_OF_PD)
+		sun6i_csi_stats_inc(stats->fifo_of[1]);
+	if (status & CSI_CH_INT_STA_FIFO2_OF_PD)
+		sun6i_csi_stats_inc(stats->fifo_of[2]);
+	if (status & CSI_CH_INT_STA_HB_OF_PD)
+		sun6i_csi_stats_inc(stats->hb_of);
+
+	trace_sun6i_csi_fifo_overflow(sdev->dev, status);
+}
+
+/* Must run before the frame done status is cleared. */
+static void sun6i_csi_sample_counters(struct sun6i_csi_dev *sdev)
+{
+	struct sun6i_csi_stats *stats = &sdev->csi.stats;
+	u32 frm_clk;
+	u32 itnl_clk;
+	u32 fifo_stat;
+	u32 pclk_stat;
+	u32 lat_us;
+	u32 bucket;
+
+	regmap_read(sdev->regmap, CSI_CH_FRM_CLK_CNT_REG, &frm_clk);
+	regmap_read(sdev->regmap, CSI_CH_ACC_ITNL_CLK_CNT_REG, &itnl_clk);
+	regmap_read(sdev->regmap, CSI_CH_FIFO_STAT_REG, &fifo_stat);
+	regmap_read(sdev->regmap, CSI_CH_PCLK_STAT_REG, &pclk_stat);
+
+	frm_clk &= CSI_CH_FRM_CLK_CNT_MASK;
+	itnl_clk &= CSI_CH_ITNL_CLK_CNT_MASK;
+
+	u64_stats_update_begin(&stats->syncp);
+	stats->frm_clk += frm_clk;
+	stats->itnl_clk += itnl_clk;
+	stats->clk_samples++;
+	u64_stats_update_end(&stats->syncp);
+
+	WRITE_ONCE(stats->frame_period, frm_clk / CSI_CNT_CLK_MHZ);
+	WRITE_ONCE(stats->pclk_line_min,
+		   FIELD_GET(CSI_CH_PCLK_STAT_LINE_MIN_MASK, pclk_stat));
+	WRITE_ONCE(stats->pclk_line_max,
+		   FIELD_GET(CSI_CH_PCLK_STAT_LINE_MAX_MASK, pclk_stat));
+	fifo_stat = FIELD_GET(CSI_CH_FIFO_STAT_FIFO_FRM_MAX_MASK, fifo_stat);
+	if (fifo_stat > stats->fifo_max)
+		WRITE_ONCE(stats->fifo_max, fifo_stat);
+
+	/* ITNL_CLK_CNT counts from the frame done pending to now. */
+	lat_us = itnl_clk / CSI_CNT_CLK_MHZ;
+	bucket = min_t(u32, fls(lat_us >> 3), SUN6I_CSI_IRQ_LAT_BUCKETS - 1);
+	sun6i_csi_stats_inc(stats->irq_lat[bucket]);
+}
+
+static void sun6i_csi_poll_mipi(struct sun6i_csi_dev *sdev)
+{
+	u32 errors;
+
+	if (sdev->csi.v4l2_ep.bus_type != V4L2_MBUS_CSI2_DPHY)
+		return;
+
+	errors = sun6i_mipi_poll_errors(&sdev->csi);
+	if (!errors)
+		return;
+
+	trace_sun6i_csi_mipi_error(sdev->dev, errors);
+	if (errors & MIPI_CSI2_CH_INT_CHKSUM_ERR)
+		sun6i_video_frame_corrupt(&sdev->csi.video);
+}
+
+/* Returns true if channel 1 had an interrupt pending. */
+static bool sun6i_csi_meta_isr(struct sun6i_csi_dev *sdev)
+{
+	unsigned int reg = CSI_CH_REG(CSI_CH_INT_STA_REG, SUN6I_META_CSI_CH);
+	u32 status;
+
+	if (!sdev->csi.meta.registered)
+		return false;
+
+	regmap_read(sdev->regmap, reg, &status);
+	if (!(status & 0xFF))
+		return false;
+
+	regmap_write(sdev->regmap, reg, status);
+	if (status & CSI_CH_INT_STA_FD_PD)
+		sun6i_meta_frame_done(&sdev->csi.meta);
+
+	return true;
+}
+
+irqreturn_t sun6i_csi_isr(int irq, void *dev_id)
 {
 	struct sun6i_csi_dev *sdev = (struct sun6i_csi_dev *)dev_id;
 	struct regmap *regmap = sdev->regmap;
+	bool meta = sun6i_csi_meta_isr(sdev);
 	u32 status;
 
 	regmap_read(regmap, CSI_CH_INT_STA_REG, &status);
 
-	if (!(status & 0xFF))
-		return IRQ_NONE;
+	if (!(status & 0xFF)) {
+		if (!meta)
+			return IRQ_NONE;
+		goto out;
+	}
 
 	if ((status & CSI_CH_INT_STA_FIFO0_OF_PD) ||
 	    (status & CSI_CH_INT_STA_FIFO1_OF_PD) ||
 	    (status & CSI_CH_INT_STA_FIFO2_OF_PD) ||
 	    (status & CSI_CH_INT_STA_HB_OF_PD)) {
+		sun6i_csi_count_overflow(sdev, status);
+		/*
+		 * Drop the corrupted frame and restart capture from the
+		 * buffer ring instead of resetting the whole CSI.
+		 */
+		sun6i_csi_set_capture(&sdev->csi, false);
 		regmap_write(regmap, CSI_CH_INT_STA_REG, status);
-		regmap_update_bits(regmap, CSI_EN_REG, CSI_EN_CSI_EN, 0);
-		regmap_update_bits(regmap, CSI_EN_REG, CSI_EN_CSI_EN,
-				   CSI_EN_CSI_EN);
-		return IRQ_HANDLED;
+		sun6i_video_recover(&sdev->csi.video);
+		goto out;
 	}
 
-	if (status & CSI_CH_INT_STA_FD_PD)
+	if (status & CSI_CH_INT_STA_FD_PD) {
+		sun6i_csi_sample_counters(sdev);
+		sun6i_csi_poll_mipi(sdev);
 		sun6i_video_frame_done(&sdev->csi.video);
+	}
+
+	/*
+	 * Handled after frame done: when both are pending, VS belongs to
+	 * the frame following the one just completed.
+	 */
+	if (status & CSI_CH_INT_STA_VS_PD)
+		sun6i_video_frame_start(&sdev->csi.video);
 
 	regmap_write(regmap, CSI_CH_INT_STA_REG, status);
 
+out:
+	/* vb2 completion and its wakeups run in sun6i_csi_isr_thread() */
+	if (sun6i_video_complete_pending(&sdev->csi.video) ||
+	    sun6i_meta_complete_pending(&sdev->csi.meta))
+		return IRQ_WAKE_THREAD;
+
 	return IRQ_HANDLED;
 }
 
+irqreturn_t sun6i_csi_isr_thread(int irq, void *dev_id)
+{
+	struct sun6i_csi_dev *sdev = (struct sun6i_csi_dev *)dev_id;
+
+	sun6i_video_complete(&sdev->csi.video);
+	sun6i_meta_complete(&sdev->csi.meta);
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * Only configuration the driver writes itself is cached. Status,
+ * counters, the capture triggers and the MIPI controller reset go to
+ * the hardware on every access.
+ */
+static bool sun6i_csi_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case CSI_EN_REG:
+	case CSI_IF_CFG_REG:
+	case CSI_FIFO_THRS_REG:
+	case CSI_BT656_HEAD_CFG_REG:
+	case CSI_PTN_LEN_REG:
+	case CSI_PTN_ADDR_REG:
+	case CSI_CH_CFG_REG:
+	case CSI_CH_SCALE_REG:
+	case CSI_CH_F0_BUFA_REG:
+	case CSI_CH_F1_BUFA_REG:
+	case CSI_CH_F2_BUFA_REG:
+	case CSI_CH_INT_EN_REG:
+	case CSI_CH_FLD1_VSIZE_REG:
+	case CSI_CH_HSIZE_REG:
+	case CSI_CH_VSIZE_REG:
+	case CSI_CH_BUF_LEN_REG:
+	case CSI_CH_FLIP_SIZE_REG:
+	case MIPI_CSI2_CFG_REG:
+	case MIPI_CSI2_VCDT_RX_REG:
+	case MIPI_CSI2_CH_CFG_REG:
+	case DPHY_CTL_REG:
+	case DPHY_RX_CTL_REG:
+	case DPHY_RX_TIME0_REG:
+	case DPHY_RX_TIME1_REG:
+	case DPHY_RX_TIME2_REG:
+	case DPHY_ANA0_REG:
+	case DPHY_ANA1_REG:
+	case DPHY_ANA2_REG:
+	case DPHY_ANA3_REG:
+	case DPHY_ANA4_REG:
+		return false;
+	default:
+		return true;
+	}
+}
+
 static const struct regmap_config sun6i_csi_regmap_config = {
 	.reg_bits       = 32,
 	.reg_stride     = 4,
 	.val_bits       = 32,
 	.max_register	= 0x20f4,
+	.volatile_reg	= sun6i_csi_volatile_reg,
+	.cache_type	= REGCACHE_RBTREE,
 };
 
 static int sun6i_csi_resource_request(struct sun6i_csi_dev *sdev,
@@ -933,9 +1184,11 @@ static int sun6i_csi_resource_request(struct sun6i_csi_dev *sdev,
 	irq = platform_get_irq(pdev, 0);
 	if (irq < 0)
 		return -ENXIO;
+	sdev->irq = irq;
 
-	ret = devm_request_irq(&pdev->dev, irq, sun6i_csi_isr, 0, MODULE_NAME,
-			       sdev);
+	ret = devm_request_threaded_irq(&pdev->dev, irq, sun6i_csi_isr,
+					sun6i_csi_isr_thread, 0, MODULE_NAME,
+					sdev);
 	if (ret) {
 		dev_err(&pdev->dev, "Cannot request csi IRQ\n");
 		return ret;
@@ -944,6 +1197,100 @@ static int sun6i_csi_resource_request(struct sun6i_csi_dev *sdev,
 	return 0;
 }
 
+/* -----------------------------------------------------------------------------
+ * debugfs
+ */
+static int sun6i_csi_stats_show(struct seq_file *s, void *data)
+{
+	struct sun6i_csi_dev *sdev = s->private;
+	struct sun6i_csi_stats *stats = &sdev->csi.stats;
+	u64 frames, drops, frm_clk, itnl_clk;
+	const char *src;
+	unsigned int start;
+	unsigned int i;
+	u32 samples;
+
+	do {
+		start = u64_stats_fetch_begin(&stats->syncp);
+		frames = stats->frames;
+		drops = stats->drops;
+		frm_clk = stats->frm_clk;
+		itnl_clk = stats->itnl_clk;
+		samples = stats->clk_samples;
+	} while (u64_stats_fetch_retry(&stats->syncp, start));
+
+	if (!samples)
+		samples = 1;
+
+	seq_printf(s, "frames: %llu\n", frames);
+	seq_printf(s, "drops: %llu\n", drops);
+	for (i = 0; i < ARRAY_SIZE(stats->fifo_of); i++)
+		seq_printf(s, "fifo%u_overflow: %u\n", i,
+			   READ_ONCE(stats->fifo_of[i]));
+	seq_printf(s, "hb_overflow: %u\n", READ_ONCE(stats->hb_of));
+	seq_printf(s, "recoveries: %u\n", READ_ONCE(stats->recoveries));
+	seq_printf(s, "start_latency_us: %u\n",
+		   READ_ONCE(stats->start_latency));
+	seq_printf(s, "frame_period_us: %u\n", READ_ONCE(stats->frame_period));
+	seq_printf(s, "pclk_per_line: %u-%u\n",
+		   READ_ONCE(stats->pclk_line_min),
+		   READ_ONCE(stats->pclk_line_max));
+	seq_printf(s, "fifo_max: %u\n", READ_ONCE(stats->fifo_max));
+	src = READ_ONCE(stats->lane_rate_src);
+	if (src)
+		seq_printf(s, "lane_rate_bps: %u (%s)\n",
+			   READ_ONCE(stats->lane_rate), src);
+	src = READ_ONCE(stats->mipi_resume_src);
+	if (src)
+		seq_printf(s, "mipi_resume_us: %u (from %s)\n",
+			   READ_ONCE(stats->mipi_resume_us), src);
+	if (sdev->csi.v4l2_ep.bus_type == V4L2_MBUS_CSI2_DPHY) {
+		seq_printf(s, "mipi_ecc_corrected: %u\n",
+			   READ_ONCE(stats->mipi_ecc_fix));
+		seq_printf(s, "mipi_ecc_errors: %u\n",
+			   READ_ONCE(stats->mipi_ecc_err));
+		seq_printf(s, "mipi_crc_errors: %u\n",
+			   READ_ONCE(stats->mipi_crc_err));
+		seq_printf(s, "mipi_frame_sync_errors: %u\n",
+			   READ_ONCE(stats->mipi_frame_sync_err));
+		seq_printf(s, "mipi_line_sync_errors: %u\n",
+			   READ_ONCE(stats->mipi_line_sync_err));
+		seq_printf(s, "mipi_eot_errors: %u\n",
+			   READ_ONCE(stats->mipi_eot_err));
+		seq_printf(s, "mipi_fifo_overflow: %u\n",
+			   READ_ONCE(stats->mipi_fifo_of));
+		seq_printf(s, "crc_drops: %u\n", READ_ONCE(stats->crc_drops));
+	}
+	if (sdev->csi.meta.registered)
+		seq_printf(s, "meta_drops: %u\n",
+			   READ_ONCE(sdev->csi.meta.drops));
+	seq_printf(s, "frm_clk_cnt_avg: %llu\n",
+		   div_u64(frm_clk, samples));
+	seq_printf(s, "itnl_clk_cnt_avg: %llu\n",
+		   div_u64(itnl_clk, samples));
+
+	seq_puts(s, "irq_latency_us:\n");
+	for (i = 0; i < SUN6I_CSI_IRQ_LAT_BUCKETS - 1; i++)
+		seq_printf(s, "  <%u: %u\n", 8 << i,
+			   READ_ONCE(stats->irq_lat[i]));
+	seq_printf(s, "  >=%u: %u\n", 8 << (i - 1),
+		   READ_ONCE(stats->irq_lat[i]));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sun6i_csi_stats);
+
+/* "sun6i-csi" in the debugfs root, one directory per CSI under it */
+static struct dentry *sun6i_csi_debugfs_root;
+
+static void sun6i_csi_debugfs_init(struct sun6i_csi_dev *sdev)
+{
+	sdev->debugfs = debugfs_create_dir(dev_name(sdev->dev),
+					   sun6i_csi_debugfs_root);
+	debugfs_create_file("stats", 0444, sdev->debugfs, sdev,
+			    &sun6i_csi_stats_fops);
+}
+
 /*
  * PHYS_OFFSET isn't available on all architectures. In order to
  * accommodate for COMPILE_TEST, let's define it to something dumb.
@@ -962,6 +1309,7 @@ static int sun6i_csi_probe(struct platform_device *pdev)
 		return -ENOMEM;
 
 	sdev->dev = &pdev->dev;
+	u64_stats_init(&sdev->csi.stats.syncp);
 	/* The DMA bus has the memory mapped at 0 */
 	sdev->dev->dma_pfn_offset = PHYS_OFFSET >> PAGE_SHIFT;
 
@@ -971,19 +1319,53 @@ static int sun6i_csi_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, sdev);
 
+	ret = reset_control_deassert(sdev->rstc_bus);
+	if (ret) {
+		dev_err(&pdev->dev, "reset err %d\n", ret);
+		return ret;
+	}
+
+	pm_runtime_set_autosuspend_delay(&pdev->dev, SUN6I_CSI_AUTOSUSPEND_MS);
+	pm_runtime_use_autosuspend(&pdev->dev);
+	pm_runtime_enable(&pdev->dev);
+
 	sdev->csi.dev = &pdev->dev;
-	return sun6i_csi_v4l2_init(&sdev->csi);
+	ret = sun6i_csi_v4l2_init(&sdev->csi);
+	if (ret)
+		goto disable_pm;
+
+	sun6i_csi_debugfs_init(sdev);
+
+	return 0;
+
+disable_pm:
+	pm_runtime_disable(&pdev->dev);
+	pm_runtime_dont_use_autosuspend(&pdev->dev);
+	reset_control_assert(sdev->rstc_bus);
+	return ret;
 }
 
 static int sun6i_csi_remove(struct platform_device *pdev)
 {
 	struct sun6i_csi_dev *sdev = platform_get_drvdata(pdev);
 
+	debugfs_remove_recursive(sdev->debugfs);
 	sun6i_csi_v4l2_cleanup(&sdev->csi);
 
+	pm_runtime_disable(&pdev->dev);
+	if (!pm_runtime_status_suspended(&pdev->dev))
+		sun6i_csi_runtime_suspend(&pdev->dev);
+	pm_runtime_dont_use_autosuspend(&pdev->dev);
+	reset_control_assert(sdev->rstc_bus);
+
 	return 0;
 }
 
+static const struct dev_pm_ops sun6i_csi_pm_ops = {
+	SET_RUNTIME_PM_OPS(sun6i_csi_runtime_suspend,
+			   sun6i_csi_runtime_resume, NULL)
+};
+
 static const struct of_device_id sun6i_csi_of_match[] = {
 	{ .compatible = "allwinner,sun6i-a31-csi", },
 	{ .compatible = "allwinner,sun8i-a83t-csi", },
@@ -1000,9 +1382,30 @@ static struct platform_driver sun6i_csi_platform_driver = {
 	.driver = {
 		.name = MODULE_NAME,
 		.of_match_table = of_match_ptr(sun6i_csi_of_match),
+		.pm = &sun6i_csi_pm_ops,
 	},
 };
-module_platform_driver(sun6i_csi_platform_driver);
+
+static int __init sun6i_csi_init(void)
+{
+	int ret;
+
+	sun6i_csi_debugfs_root = debugfs_create_dir(MODULE_NAME, NULL);
+
+	ret = platform_driver_register(&sun6i_csi_platform_driver);
+	if (ret)
+		debugfs_remove_recursive(sun6i_csi_debugfs_root);
+
+	return ret;
+}
+module_init(sun6i_csi_init);
+
+static void __exit sun6i_csi_exit(void)
+{
+	platform_driver_unregister(&sun6i_csi_platform_driver);
+	debugfs_remove_recursive(sun6i_csi_debugfs_root);
+}
+module_exit(sun6i_csi_exit);
 
 MODULE_DESCRIPTION("Allwinner V3s Camera Sensor Interface driver");
 MODULE_AUTHOR("Yong Deng <yong.deng@magewell.com>");
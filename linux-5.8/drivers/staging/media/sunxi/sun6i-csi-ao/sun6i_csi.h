@@ -8,14 +8,25 @@
 #ifndef __SUN6I_CSI_H__
 #define __SUN6I_CSI_H__
 
+#include <linux/interrupt.h>
+#include <linux/u64_stats_sync.h>
+
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fwnode.h>
 
+#include "sun6i_meta.h"
 #include "sun6i_video.h"
 
 struct sun6i_csi;
 
+/* F0/F1/F2 buffer address registers */
+#define SUN6I_CSI_MAX_PLANES	3
+/* The buffer address registers hold word addresses */
+#define SUN6I_CSI_BUF_ALIGN	4
+/* Largest line stride CSI_CH_BUF_LEN_REG can hold */
+#define SUN6I_CSI_MAX_STRIDE	0x3fff
+
 /**
  * struct sun6i_csi_config - configs for sun6i csi
  * @pixelformat: v4l2 pixel format (V4L2_PIX_FMT_*)
@@ -23,6 +34,15 @@ struct sun6i_csi;
  * @field:	used interlacing type (enum v4l2_field)
  * @width:	frame width
  * @height:	frame height
+ * @bytesperline: line stride of the first plane of YUV formats, may be
+ *		larger than the packed line
+ * @window:	window of the source frame to capture
+ * @quarter:	scale the window down to a quarter of its width and height
+ * @lanes:	MIPI data lanes negotiated with the sensor, 0 on parallel
+ *		buses. Set by sun6i_csi_update_config().
+ * @lane_bps:	MIPI lane rate the DPHY is set up for, 0 on parallel buses.
+ *		Set by sun6i_csi_update_config().
+ * @lane_bps_src: where @lane_bps comes from: sensor, dt or default
  */
 struct sun6i_csi_config {
 	u32		pixelformat;
@@ -30,8 +50,120 @@ struct sun6i_csi_config {
 	u32		field;
 	u32		width;
 	u32		height;
+	u32		bytesperline;
+	struct v4l2_rect window;
+	bool		quarter;
+	u32		lanes;
+	u32		lane_bps;
+	const char	*lane_bps_src;
+};
+
+/**
+ * struct sun6i_csi_format - a supported (pixformat, mbus code) pair
+ * @pixelformat: v4l2 pixel format (V4L2_PIX_FMT_*)
+ * @mbus_code:	media bus format code (MEDIA_BUS_FMT_*)
+ * @input_fmt:	CSI_CH_CFG_REG input format (enum csi_input_fmt)
+ * @output_fmt:	CSI_CH_CFG_REG output format for field buffers
+ *		(enum csi_output_fmt)
+ * @output_fmt_frame: CSI_CH_CFG_REG output format for interlaced buffers
+ * @input_seq:	CSI_CH_CFG_REG YUV input sequence (enum csi_input_seq)
+ * @mipi_dt:	MIPI CSI-2 data type of @mbus_code (enum pkt_fmt)
+ * @bpp:	bits per pixel, all planes together
+ * @planes:	1 for packed, 2 for semi-planar, 3 for planar formats
+ * @vdiv:	vertical chroma subsampling of planar formats
+ * @hsize_mul:	CSI_CH_HSIZE_REG units per pixel
+ * @bus16:	@mbus_code only comes over a 16bit parallel bus
+ * @yuv:	@pixelformat is a YUV format, the only ones whose lines
+ *		may be padded to a larger stride
+ */
+struct sun6i_csi_format {
+	u32		pixelformat;
+	u32		mbus_code;
+	u8		input_fmt;
+	u8		output_fmt;
+	u8		output_fmt_frame;
+	u8		input_seq;
+	u8		mipi_dt;
+	u8		bpp;
+	u8		planes;
+	u8		vdiv;
+	u8		hsize_mul;
+	bool		bus16;
+	bool		yuv;
+};
+
+/* IRQ latency histogram buckets: <8us, <16us, ..., <512us, >=512us */
+#define SUN6I_CSI_IRQ_LAT_BUCKETS	8
+
+/**
+ * struct sun6i_csi_stats - running capture counters, shown in debugfs
+ * @syncp:	keeps the 64 bit counters, and @clk_samples averaged with
+ *		them, from being torn on 32 bit. They are only written by
+ *		the frame done ISR, or the TPG timer standing in for it.
+ *		Every other field has a single writer too, which stores it
+ *		with WRITE_ONCE(), so debugfs and the read-only controls
+ *		can READ_ONCE() it without a lock.
+ * @frames:	frames delivered to userspace
+ * @drops:	frames dropped for lack of queued buffers
+ * @fifo_of:	FIFO0/1/2 overflow count
+ * @hb_of:	horizontal blanking FIFO overflow count
+ * @recoveries:	capture restarts completed after an overflow
+ * @irq_lat:	frame done IRQ latency histogram
+ * @frm_clk:	sum of CSI_CH_FRM_CLK_CNT_REG samples
+ * @itnl_clk:	sum of ITNL_CLK_CNT samples from CSI_CH_ACC_ITNL_CLK_CNT_REG
+ * @clk_samples: number of samples in @frm_clk and @itnl_clk
+ * @start_latency: STREAMON to first frame done of the last start, in us
+ * @frame_period: last CSI_CH_FRM_CLK_CNT_REG sample, in us
+ * @pclk_line_min: fewest pixel clocks per line in the last frame
+ * @pclk_line_max: most pixel clocks per line in the last frame
+ * @fifo_max:	FIFO high-water mark since the stream started
+ * @lane_rate:	MIPI lane rate the DPHY is timed for, in bps
+ * @lane_rate_src: where @lane_rate comes from: measured, sensor, dt
+ *		or default
+ * @mipi_resume_us: time the last MIPI receiver start took, in us
+ * @mipi_resume_src: state it started from: off or idle
+ * @mipi_ecc_fix: frames with a packet header the receiver corrected
+ * @mipi_ecc_err: frames with an uncorrectable packet header
+ * @mipi_crc_err: frames with a payload checksum error
+ * @mipi_frame_sync_err: frames with unmatched frame start/end packets
+ * @mipi_line_sync_err: frames with unmatched line start/end packets
+ * @mipi_eot_err: frames with a packet cut short by end of transmission
+ * @mipi_fifo_of: frames overflowing the MIPI receiver FIFO
+ * @crc_drops:	frames returned as errored because of @mipi_crc_err
+ */
+struct sun6i_csi_stats {
+	struct u64_stats_sync syncp;
+	u64		frames;
+	u64		drops;
+	u32		fifo_of[3];
+	u32		hb_of;
+	u32		recoveries;
+	u32		irq_lat[SUN6I_CSI_IRQ_LAT_BUCKETS];
+	u64		frm_clk;
+	u64		itnl_clk;
+	u32		clk_samples;
+	u32		start_latency;
+	u32		frame_period;
+	u32		pclk_line_min;
+	u32		pclk_line_max;
+	u32		fifo_max;
+	u32		lane_rate;
+	const char	*lane_rate_src;
+	u32		mipi_resume_us;
+	const char	*mipi_resume_src;
+	u32		mipi_ecc_fix;
+	u32		mipi_ecc_err;
+	u32		mipi_crc_err;
+	u32		mipi_frame_sync_err;
+	u32		mipi_line_sync_err;
+	u32		mipi_eot_err;
+	u32		mipi_fifo_of;
+	u32		crc_drops;
 };
 
+/* Bumps a 32 bit counter of struct sun6i_csi_stats from its one writer. */
+#define sun6i_csi_stats_inc(cnt)	WRITE_ONCE(cnt, (cnt) + 1)
+
 struct sun6i_csi {
 	struct device			*dev;
 	struct v4l2_ctrl_handler	ctrl_handler;
@@ -44,8 +176,20 @@ struct sun6i_csi {
 	struct v4l2_fwnode_endpoint	v4l2_ep;
 
 	struct sun6i_csi_config		config;
+	/* descriptor of config.pixelformat coming from config.code */
+	const struct sun6i_csi_format	*fmt;
+	struct sun6i_csi_stats		stats;
 
 	struct sun6i_video		video;
+	/* metadata VC/DT on CSI channel 1, if allwinner,mipi-csi-meta */
+	struct sun6i_meta		meta;
+};
+
+/* MIPI receiver power states, see sun6i_mipi_set_state() */
+enum sun6i_mipi_state {
+	SUN6I_MIPI_OFF,
+	SUN6I_MIPI_IDLE,
+	SUN6I_MIPI_ON,
 };
 
 struct sun6i_csi_dev {
@@ -57,10 +201,45 @@ struct sun6i_csi_dev {
 	struct clk			*clk_ram;
 	struct clk			*clk_dphy;
 	struct reset_control		*rstc_bus;
+	int				irq;
+	struct dentry			*debugfs;
 
 	int				planar_offset[3];
+
+	/*
+	 * Last configuration written to the hardware. update_config only
+	 * reprograms the blocks whose inputs changed. Still valid after a
+	 * runtime suspend: that only gates the clocks, the bus reset stays
+	 * deasserted from probe to remove, so the registers keep what the
+	 * regcache holds for them. Only the MIPI receiver and DPHY are
+	 * stopped, which mipi_state tracks.
+	 */
+	struct sun6i_csi_config		applied;
+	bool				applied_valid;
+	/* MIPI receiver and DPHY, may be left up across STREAMOFF */
+	enum sun6i_mipi_state		mipi_state;
+	/* lane rate measured since the DPHY was last set up */
+	bool				lane_rate_checked;
 };
 
+/**
+ * sun6i_csi_find_format() - look up the descriptor of a format pair
+ * @pixformat:	v4l2 pixel format (V4L2_PIX_FMT_*)
+ * @mbus_code:	media bus format code (MEDIA_BUS_FMT_*), 0 for any
+ *
+ * Returns NULL if the pair is not built in.
+ */
+const struct sun6i_csi_format *sun6i_csi_find_format(u32 pixformat,
+						     u32 mbus_code);
+
+/**
+ * sun6i_csi_enum_pixformat() - enumerate the built in pixel formats
+ * @index:	index of the pixel format
+ *
+ * Returns 0 past the last one.
+ */
+u32 sun6i_csi_enum_pixformat(unsigned int index);
+
 /**
  * sun6i_csi_is_format_supported() - check if the format supported by csi
  * @csi:	pointer to the csi
@@ -71,9 +250,12 @@ bool sun6i_csi_is_format_supported(struct sun6i_csi *csi, u32 pixformat,
 				   u32 mbus_code);
 
 /**
- * sun6i_csi_set_power() - power on/off the csi
+ * sun6i_csi_set_power() - take/drop a runtime PM reference on the csi
  * @csi:	pointer to the csi
  * @enable:	on/off
+ *
+ * Dropping the last reference powers the csi off after the autosuspend
+ * delay.
  */
 int sun6i_csi_set_power(struct sun6i_csi *csi, bool enable);
 
@@ -88,9 +270,73 @@ int sun6i_csi_update_config(struct sun6i_csi *csi,
 /**
  * sun6i_csi_update_buf_addr() - update the csi frame buffer address
  * @csi:	pointer to the csi
- * @addr:	frame buffer's physical address
+ * @addr:	physical address of each memory plane
+ * @num_planes:	number of memory planes, 1 for a contiguous frame buffer
+ *
+ * With a single memory plane the F1/F2 addresses are derived from the
+ * planar offsets of the configured format.
+ */
+void sun6i_csi_update_buf_addr(struct sun6i_csi *csi, const dma_addr_t *addr,
+			       unsigned int num_planes);
+
+/**
+ * sun6i_csi_set_capture() - start/stop csi video capture only
+ * @csi:	pointer to the csi
+ * @enable:	start/stop
+ *
+ * Unlike sun6i_csi_set_stream() this leaves interrupts and the MIPI
+ * receiver alone. Capture starts at the next vsync.
+ */
+void sun6i_csi_set_capture(struct sun6i_csi *csi, bool enable);
+
+/**
+ * sun6i_csi_set_fps_ds() - enable/disable frame rate down sampling
+ * @csi:	pointer to the csi
+ * @enable:	capture every other frame only
+ *
+ * The skipped frames are never written to memory and raise no frame done
+ * interrupt. Safe to call while streaming.
  */
-void sun6i_csi_update_buf_addr(struct sun6i_csi *csi, dma_addr_t addr);
+void sun6i_csi_set_fps_ds(struct sun6i_csi *csi, bool enable);
+
+/**
+ * sun6i_csi_meta_set_buf_addr() - program the metadata channel buffer
+ * @csi:	pointer to the csi
+ * @addr:	DMA address of the buffer for the frame after next
+ */
+void sun6i_csi_meta_set_buf_addr(struct sun6i_csi *csi, dma_addr_t addr);
+
+/**
+ * sun6i_csi_meta_set_stream() - start/stop capture on the metadata channel
+ * @csi:	pointer to the csi
+ * @enable:	start/stop
+ *
+ * Channel 1 only. The receiver and channel 0 follow sun6i_csi_set_stream().
+ */
+void sun6i_csi_meta_set_stream(struct sun6i_csi *csi, bool enable);
+
+/**
+ * sun6i_csi_check_bandwidth() - check the source mode fits the bus
+ * @csi:	pointer to the csi
+ * @sd:		source subdev
+ * @pixformat:	v4l2 pixel format (V4L2_PIX_FMT_*)
+ * @mf:		active format on the source pad
+ *
+ * Returns -EPIPE if the sensor sends more than its MIPI lanes carry.
+ */
+int sun6i_csi_check_bandwidth(struct sun6i_csi *csi, struct v4l2_subdev *sd,
+			      u32 pixformat,
+			      const struct v4l2_mbus_framefmt *mf);
+
+/**
+ * sun6i_csi_calibrate() - retime the DPHY to the measured lane rate
+ * @csi:	pointer to the csi
+ *
+ * Call with the sensor streaming. Does nothing for parallel buses or
+ * when the rate was already checked since the last bus setup. A retime
+ * restarts the DPHY and loses the frame in flight.
+ */
+void sun6i_csi_calibrate(struct sun6i_csi *csi);
 
 /**
  * sun6i_csi_set_stream() - start/stop csi streaming
@@ -99,52 +345,11 @@ void sun6i_csi_update_buf_addr(struct sun6i_csi *csi, dma_addr_t addr);
  */
 void sun6i_csi_set_stream(struct sun6i_csi *csi, bool enable);
 
-/* get bpp form v4l2 pixformat */
-static inline int sun6i_csi_get_bpp(unsigned int pixformat)
-{
-	switch (pixformat) {
-	case V4L2_PIX_FMT_SBGGR8:
-	case V4L2_PIX_FMT_SGBRG8:
-	case V4L2_PIX_FMT_SGRBG8:
-	case V4L2_PIX_FMT_SRGGB8:
-	case V4L2_PIX_FMT_JPEG:
-		return 8;
-	case V4L2_PIX_FMT_SBGGR10:
-	case V4L2_PIX_FMT_SGBRG10:
-	case V4L2_PIX_FMT_SGRBG10:
-	case V4L2_PIX_FMT_SRGGB10:
-		return 10;
-	case V4L2_PIX_FMT_SBGGR12:
-	case V4L2_PIX_FMT_SGBRG12:
-	case V4L2_PIX_FMT_SGRBG12:
-	case V4L2_PIX_FMT_SRGGB12:
-	case V4L2_PIX_FMT_NV12:
-	case V4L2_PIX_FMT_NV21:
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-		return 12;
-	case V4L2_PIX_FMT_YUYV:
-	case V4L2_PIX_FMT_YVYU:
-	case V4L2_PIX_FMT_UYVY:
-	case V4L2_PIX_FMT_VYUY:
-	case V4L2_PIX_FMT_NV16:
-	case V4L2_PIX_FMT_NV61:
-	case V4L2_PIX_FMT_YUV422P:
-	case V4L2_PIX_FMT_RGB565:
-	case V4L2_PIX_FMT_RGB565X:
-		return 16;
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-		return 24;
-	case V4L2_PIX_FMT_RGB32:
-	case V4L2_PIX_FMT_BGR32:
-		return 32;
-	default:
-		WARN(1, "Unsupported pixformat: 0x%x\n", pixformat);
-		break;
-	}
-
-	return 0;
-}
+/*
+ * Interrupt handler of the capture channels and its thread. Only the IRQ
+ * core calls them, and the KUnit suites in sun6i_video.c.
+ */
+irqreturn_t sun6i_csi_isr(int irq, void *dev_id);
+irqreturn_t sun6i_csi_isr_thread(int irq, void *dev_id);
 
 #endif /* __SUN6I_CSI_H__ */
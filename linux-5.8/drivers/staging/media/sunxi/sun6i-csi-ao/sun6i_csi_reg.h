@@ -49,6 +49,7 @@
 #define CSI_CAP_CH0_CAP_MASK(count)		(((count) << 2) & CSI_CAP_CH0_CAP_MASK_MASK)
 #define CSI_CAP_CH0_VCAP_ON			BIT(1)
 #define CSI_CAP_CH0_SCAP_ON			BIT(0)
+#define CSI_CAP_CH_VCAP_ON(ch)			BIT((ch) * 8 + 1)
 
 #define CSI_SYNC_CNT_REG		0xc
 #define CSI_FIFO_THRS_REG		0x10
@@ -57,6 +58,12 @@
 #define CSI_PTN_ADDR_REG		0x34
 #define CSI_VER_REG			0x3c
 
+/*
+ * CSI_CH_* registers are those of channel 0. Channels 1 to 3 repeat
+ * them every 0x100 bytes, as in the vendor BSP.
+ */
+#define CSI_CH_REG(reg, ch)		((reg) + (ch) * 0x100)
+
 #define CSI_CH_CFG_REG			0x44
 #define CSI_CH_CFG_INPUT_FMT_MASK		GENMASK(23, 20)
 #define CSI_CH_CFG_INPUT_FMT(fmt)		(((fmt) << 20) & CSI_CH_CFG_INPUT_FMT_MASK)
@@ -134,9 +141,18 @@
 #define CSI_CH_FLIP_SIZE_VALID_LEN(len)		(((len) << 0) & CSI_CH_FLIP_SIZE_VALID_LEN_MASK)
 
 #define CSI_CH_FRM_CLK_CNT_REG		0x90
+#define CSI_CH_FRM_CLK_CNT_MASK			GENMASK(23, 0)
+
 #define CSI_CH_ACC_ITNL_CLK_CNT_REG	0x94
+#define CSI_CH_ACC_CLK_CNT_MASK			GENMASK(31, 24)
+#define CSI_CH_ITNL_CLK_CNT_MASK		GENMASK(23, 0)
+
 #define CSI_CH_FIFO_STAT_REG		0x98
+#define CSI_CH_FIFO_STAT_FIFO_FRM_MAX_MASK	GENMASK(11, 0)
+
 #define CSI_CH_PCLK_STAT_REG		0x9c
+#define CSI_CH_PCLK_STAT_LINE_MAX_MASK		GENMASK(30, 16)
+#define CSI_CH_PCLK_STAT_LINE_MIN_MASK		GENMASK(14, 0)
 
 /*
  * csi input data format
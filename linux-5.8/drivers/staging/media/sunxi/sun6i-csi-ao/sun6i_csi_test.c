@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * KUnit tests of the interrupt handler, driven by the channel 0 interrupt
+ * status register of the fake CSI. Included at the end of sun6i_video.c
+ * right after sun6i_video_test.c, whose fake CSI and helpers it uses.
+ */
+
+/* Raise @status, then run the handler and its thread as the IRQ core does */
+static int sun6i_csi_test_irq(struct sun6i_csi_test *t, u32 status)
+{
+	irqreturn_t ret;
+
+	t->regs[CSI_CH_INT_STA_REG / 4] |= status;
+
+	ret = sun6i_csi_isr(t->sdev.irq, &t->sdev);
+	if (ret == IRQ_WAKE_THREAD)
+		sun6i_csi_isr_thread(t->sdev.irq, &t->sdev);
+
+	return ret;
+}
+
+static bool sun6i_csi_test_capturing(struct sun6i_csi_test *t)
+{
+	return t->regs[CSI_CAP_REG / 4] & CSI_CAP_CH0_VCAP_ON;
+}
+
+static void sun6i_csi_test_spurious(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+
+	KUNIT_EXPECT_EQ(test, sun6i_csi_test_irq(t, 0), IRQ_NONE);
+}
+
+static void sun6i_csi_test_overflow_recover(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_csi_stats *stats = &t->sdev.csi.stats;
+	struct sun6i_video *video = &t->sdev.csi.video;
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		sun6i_csi_test_qbuf(t, i);
+	sun6i_csi_test_start(t);
+
+	/* Frame 0 captured in buffer 0 */
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_VS_PD);
+	KUNIT_EXPECT_EQ(test, sun6i_csi_test_irq(t, CSI_CH_INT_STA_FD_PD),
+			IRQ_WAKE_THREAD);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 0), VB2_BUF_STATE_DONE);
+
+	/* FIFO overflow in frame 1: buffer 1 errored, capture restarted */
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_VS_PD);
+	KUNIT_EXPECT_EQ(test,
+			sun6i_csi_test_irq(t, CSI_CH_INT_STA_FIFO0_OF_PD),
+			IRQ_WAKE_THREAD);
+	KUNIT_EXPECT_EQ(test, t->regs[CSI_CH_INT_STA_REG / 4], 0U);
+	KUNIT_EXPECT_EQ(test, stats->fifo_of[0], 1U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 1),
+			VB2_BUF_STATE_ERROR);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, 1), 1U);
+	KUNIT_EXPECT_TRUE(test, sun6i_csi_test_capturing(t));
+	KUNIT_EXPECT_TRUE(test, video->recovering);
+	KUNIT_EXPECT_EQ(test, stats->recoveries, 0U);
+
+	/* The ring is programmed again from buffer 2 */
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 2U);
+	KUNIT_EXPECT_EQ(test, video->ring_armed, 4U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t), SUN6I_CSI_TEST_DMA(3));
+
+	/*
+	 * The frame done of the overflowed frame may still be pending with
+	 * the next vsync: it is ignored and capture resumes.
+	 */
+	KUNIT_EXPECT_EQ(test,
+			sun6i_csi_test_irq(t, CSI_CH_INT_STA_FD_PD |
+					      CSI_CH_INT_STA_VS_PD),
+			IRQ_HANDLED);
+	KUNIT_EXPECT_FALSE(test, video->recovering);
+	KUNIT_EXPECT_EQ(test, stats->recoveries, 1U);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 2U);
+
+	/* Frame 2 lands in buffer 2 */
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_FD_PD);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 2), VB2_BUF_STATE_DONE);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, 2), 2U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 3),
+			VB2_BUF_STATE_ACTIVE);
+	KUNIT_EXPECT_EQ(test, stats->drops, 0ULL);
+}
+
+static void sun6i_csi_test_overflow_starved(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_csi_stats *stats = &t->sdev.csi.stats;
+	struct sun6i_video *video = &t->sdev.csi.video;
+
+	sun6i_csi_test_qbuf(t, 0);
+	sun6i_csi_test_qbuf(t, 1);
+	sun6i_csi_test_start(t);
+
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_VS_PD);
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_FD_PD);
+
+	/* CSI cannot do without buffer 1, the frame is dropped instead */
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_VS_PD);
+	KUNIT_EXPECT_EQ(test,
+			sun6i_csi_test_irq(t, CSI_CH_INT_STA_FIFO1_OF_PD |
+					      CSI_CH_INT_STA_HB_OF_PD),
+			IRQ_HANDLED);
+	KUNIT_EXPECT_EQ(test, stats->fifo_of[1], 1U);
+	KUNIT_EXPECT_EQ(test, stats->hb_of, 1U);
+	KUNIT_EXPECT_EQ(test, stats->drops, 1ULL);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 1),
+			VB2_BUF_STATE_ACTIVE);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t), SUN6I_CSI_TEST_DMA(1));
+	KUNIT_EXPECT_TRUE(test, sun6i_csi_test_capturing(t));
+
+	/* Resumed into buffer 1, a late QBUF is armed behind it */
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_VS_PD);
+	KUNIT_EXPECT_EQ(test, stats->recoveries, 1U);
+	sun6i_csi_test_qbuf(t, 2);
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_FD_PD);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t), SUN6I_CSI_TEST_DMA(2));
+
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_VS_PD);
+	sun6i_csi_test_irq(t, CSI_CH_INT_STA_FD_PD);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 1), VB2_BUF_STATE_DONE);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 2U);
+}
+
+static struct kunit_case sun6i_csi_isr_test_cases[] = {
+	KUNIT_CASE(sun6i_csi_test_spurious),
+	KUNIT_CASE(sun6i_csi_test_overflow_recover),
+	KUNIT_CASE(sun6i_csi_test_overflow_starved),
+	{}
+};
+
+static struct kunit_suite sun6i_csi_isr_test_suite = {
+	.name		= "sun6i-csi-isr",
+	.init		= sun6i_csi_test_init,
+	.exit		= sun6i_csi_test_exit,
+	.test_cases	= sun6i_csi_isr_test_cases,
+};
+
+kunit_test_suites(&sun6i_csi_isr_test_suite);
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Tracepoints for the sun6i CSI capture path
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sun6i_csi
+
+#if !defined(__SUN6I_CSI_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __SUN6I_CSI_TRACE_H__
+
+#include <linux/device.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(sun6i_csi_buffer_queue,
+	TP_PROTO(struct device *dev, unsigned int index,
+		 unsigned int queued),
+	TP_ARGS(dev, index, queued),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, index)
+		__field(unsigned int, queued)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->index = index;
+		__entry->queued = queued;
+	),
+	TP_printk("%s index=%u queued=%u", __get_str(dev),
+		  __entry->index, __entry->queued)
+);
+
+TRACE_EVENT(sun6i_csi_frame_done,
+	TP_PROTO(struct device *dev, unsigned int index,
+		 unsigned int sequence, u64 timestamp),
+	TP_ARGS(dev, index, sequence, timestamp),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, index)
+		__field(unsigned int, sequence)
+		__field(u64, timestamp)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->index = index;
+		__entry->sequence = sequence;
+		__entry->timestamp = timestamp;
+	),
+	TP_printk("%s index=%u sequence=%u timestamp=%llu", __get_str(dev),
+		  __entry->index, __entry->sequence, __entry->timestamp)
+);
+
+TRACE_EVENT(sun6i_csi_frame_drop,
+	TP_PROTO(struct device *dev, unsigned int sequence,
+		 unsigned int queued),
+	TP_ARGS(dev, sequence, queued),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, sequence)
+		__field(unsigned int, queued)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->sequence = sequence;
+		__entry->queued = queued;
+	),
+	TP_printk("%s sequence=%u queued=%u", __get_str(dev),
+		  __entry->sequence, __entry->queued)
+);
+
+TRACE_EVENT(sun6i_csi_fifo_overflow,
+	TP_PROTO(struct device *dev, u32 status),
+	TP_ARGS(dev, status),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, status)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->status = status;
+	),
+	TP_printk("%s status=0x%02x", __get_str(dev), __entry->status)
+);
+
+TRACE_EVENT(sun6i_csi_mipi_error,
+	TP_PROTO(struct device *dev, u32 status),
+	TP_ARGS(dev, status),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, status)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->status = status;
+	),
+	TP_printk("%s status=0x%08x", __get_str(dev), __entry->status)
+);
+
+TRACE_EVENT(sun6i_csi_stream,
+	TP_PROTO(struct device *dev, bool enable),
+	TP_ARGS(dev, enable),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(bool, enable)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->enable = enable;
+	),
+	TP_printk("%s %s", __get_str(dev),
+		  __entry->enable ? "on" : "off")
+);
+
+#endif /* __SUN6I_CSI_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE sun6i_csi_trace
+#include <trace/define_trace.h>
@@ -10,14 +10,21 @@
 #include <linux/regmap.h>
 #include "sun6i_csi.h"
 
+/* Lane rates the DPHY can receive */
+#define DPHY_MIN_BPS (80 * 1000 * 1000)
+#define DPHY_MAX_BPS (1500 * 1000 * 1000)
+
 struct sun6i_dphy_param {
 	unsigned int lane_num;
 	unsigned int bps;
 };
 
 extern void sun6i_dphy_enable(struct sun6i_csi_dev *sdev);
-extern void sun6i_dphy_disable(struct sun6i_csi_dev *sdev);
+extern void sun6i_dphy_idle(struct sun6i_csi_dev *sdev);
+void sun6i_dphy_ana_exit(struct regmap *regmap);
 void sun6i_dphy_set_param(struct sun6i_csi_dev *sdev,
 			  struct sun6i_dphy_param *param);
+void sun6i_dphy_set_timing(struct regmap *regmap, unsigned int mipi_bps);
+unsigned int sun6i_dphy_det_mipi_clk(struct sun6i_csi_dev *sdev);
 
 #endif /* __SUN6I_DPHY_H__ */
\ No newline at end of file
@@ -0,0 +1,458 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (c) 2020- Aodzip
+ * All rights reserved.
+ * Author: Aodzip <aodzip@gmail.com>
+ *
+ * Metadata capture node. The MIPI receiver routes a second VC/DT, such
+ * as the sensor's embedded data, to CSI channel 1, which writes it to
+ * its own buffers next to the image channel 0 captures.
+ */
+
+#include <linux/ktime.h>
+#include <linux/of.h>
+
+#include <media/v4l2-device.h>
+#include <media/v4l2-event.h>
+#include <media/v4l2-ioctl.h>
+#include <media/videobuf2-dma-contig.h>
+#include <media/videobuf2-v4l2.h>
+
+#include "sun6i_csi.h"
+#include "sun6i_meta.h"
+
+/* CSI_CH_HSIZE_REG and CSI_CH_VSIZE_REG hold 13 bit lengths */
+#define SUN6I_META_MAX_LEN		8191
+
+struct sun6i_meta_buffer {
+	struct vb2_v4l2_buffer		vb;
+	dma_addr_t			dma_addr;
+};
+
+static unsigned int sun6i_meta_size(struct sun6i_meta *meta)
+{
+	return meta->bytesperline * meta->lines;
+}
+
+/* -----------------------------------------------------------------------------
+ * Buffer ring
+ */
+static struct sun6i_meta_buffer *
+sun6i_meta_ring_slot(struct sun6i_meta *meta, unsigned int index)
+{
+	return meta->ring[index & (SUN6I_META_RING_SIZE - 1)];
+}
+
+/* Hand the oldest not yet programmed buffer to the CSI DMA. */
+static void sun6i_meta_ring_arm(struct sun6i_meta *meta)
+{
+	struct sun6i_meta_buffer *buf;
+
+	buf = sun6i_meta_ring_slot(meta, meta->ring_armed);
+	sun6i_csi_meta_set_buf_addr(meta->csi, buf->dma_addr);
+	meta->ring_armed++;
+}
+
+/* Return the filled buffers before @tail to vb2. */
+static void sun6i_meta_complete_until(struct sun6i_meta *meta,
+				      unsigned int tail)
+{
+	struct sun6i_meta_buffer *buf;
+
+	while (meta->ring_done != tail) {
+		buf = sun6i_meta_ring_slot(meta, meta->ring_done);
+
+		/* The slot may be reused by buffer_queue from here on. */
+		smp_store_release(&meta->ring_done, meta->ring_done + 1);
+
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
+	}
+}
+
+/*
+ * Give every buffer left in the ring back to vb2. Channel 1 must be
+ * stopped and the IRQ synchronized with @streaming clear, so that
+ * neither the ISR nor the IRQ thread touch the ring any more.
+ */
+static void sun6i_meta_ring_flush(struct sun6i_meta *meta,
+				  enum vb2_buffer_state state)
+{
+	unsigned int head = smp_load_acquire(&meta->ring_head);
+	struct sun6i_meta_buffer *buf;
+
+	/* Frames filled before the stop keep their state. */
+	sun6i_meta_complete_until(meta, meta->ring_tail);
+
+	while (meta->ring_done != head) {
+		buf = sun6i_meta_ring_slot(meta, meta->ring_done);
+		smp_store_release(&meta->ring_done, meta->ring_done + 1);
+		vb2_buffer_done(&buf->vb.vb2_buf, state);
+	}
+
+	meta->ring_tail = meta->ring_done;
+	meta->ring_armed = meta->ring_done;
+}
+
+/* -----------------------------------------------------------------------------
+ * Videobuf2 Operations
+ */
+static int sun6i_meta_queue_setup(struct vb2_queue *vq,
+				  unsigned int *nbuffers,
+				  unsigned int *nplanes,
+				  unsigned int sizes[],
+				  struct device *alloc_devs[])
+{
+	struct sun6i_meta *meta = vb2_get_drv_priv(vq);
+	unsigned int size = sun6i_meta_size(meta);
+
+	if (*nplanes)
+		return sizes[0] < size ? -EINVAL : 0;
+
+	*nplanes = 1;
+	sizes[0] = size;
+
+	return 0;
+}
+
+static int sun6i_meta_buffer_prepare(struct vb2_buffer *vb)
+{
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct sun6i_meta_buffer *buf =
+			container_of(vbuf, struct sun6i_meta_buffer, vb);
+	struct sun6i_meta *meta = vb2_get_drv_priv(vb->vb2_queue);
+	unsigned long size = sun6i_meta_size(meta);
+
+	if (vb2_plane_size(vb, 0) < size) {
+		v4l2_err(meta->vdev.v4l2_dev, "buffer too small (%lu < %lu)\n",
+			 vb2_plane_size(vb, 0), size);
+		return -EINVAL;
+	}
+
+	buf->dma_addr = vb2_dma_contig_plane_dma_addr(vb, 0);
+	if (!IS_ALIGNED(buf->dma_addr, SUN6I_CSI_BUF_ALIGN)) {
+		v4l2_err(meta->vdev.v4l2_dev, "address %pad not aligned\n",
+			 &buf->dma_addr);
+		return -EINVAL;
+	}
+
+	vb2_set_plane_payload(vb, 0, size);
+	vbuf->field = V4L2_FIELD_NONE;
+
+	return 0;
+}
+
+static void sun6i_meta_buffer_queue(struct vb2_buffer *vb)
+{
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct sun6i_meta_buffer *buf =
+			container_of(vbuf, struct sun6i_meta_buffer, vb);
+	struct sun6i_meta *meta = vb2_get_drv_priv(vb->vb2_queue);
+	unsigned int head = meta->ring_head;
+
+	/* vb2 never owns more than VB2_MAX_FRAME buffers, see ring size. */
+	if (WARN_ON(head - smp_load_acquire(&meta->ring_done) >=
+		    SUN6I_META_RING_SIZE)) {
+		vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
+		return;
+	}
+
+	meta->ring[head & (SUN6I_META_RING_SIZE - 1)] = buf;
+
+	/* Publish the slot to the frame done ISR. */
+	smp_store_release(&meta->ring_head, head + 1);
+}
+
+/*
+ * Channel 1 only sees packets while the video node streams: the sensor
+ * and the MIPI receiver are started by the image capture.
+ */
+static int sun6i_meta_start_streaming(struct vb2_queue *vq,
+				      unsigned int count)
+{
+	struct sun6i_meta *meta = vb2_get_drv_priv(vq);
+	int ret;
+
+	ret = sun6i_csi_set_power(meta->csi, true);
+	if (ret) {
+		sun6i_meta_ring_flush(meta, VB2_BUF_STATE_QUEUED);
+		return ret;
+	}
+
+	WRITE_ONCE(meta->drops, 0);
+
+	/*
+	 * Like channel 0, channel 1 looks the address of the next frame up
+	 * before the frame done of the current one: program two buffers.
+	 * min_buffers_needed guarantees they are in the ring, and the first
+	 * frame done cannot come before the second one is armed.
+	 */
+	sun6i_meta_ring_arm(meta);
+
+	WRITE_ONCE(meta->streaming, true);
+	sun6i_csi_meta_set_stream(meta->csi, true);
+
+	sun6i_meta_ring_arm(meta);
+
+	return 0;
+}
+
+static void sun6i_meta_stop_streaming(struct vb2_queue *vq)
+{
+	struct sun6i_meta *meta = vb2_get_drv_priv(vq);
+
+	WRITE_ONCE(meta->streaming, false);
+	sun6i_csi_meta_set_stream(meta->csi, false);
+	sun6i_meta_ring_flush(meta, VB2_BUF_STATE_ERROR);
+	sun6i_csi_set_power(meta->csi, false);
+}
+
+/* Called from the hard IRQ handler on the channel 1 frame done. */
+void sun6i_meta_frame_done(struct sun6i_meta *meta)
+{
+	unsigned int head;
+	unsigned int tail;
+	struct sun6i_meta_buffer *buf;
+
+	if (!READ_ONCE(meta->streaming))
+		return;
+
+	head = smp_load_acquire(&meta->ring_head);
+	tail = meta->ring_tail;
+
+	/* Only one buffer left, CSI writes the next frame over it. */
+	if (head - tail < 2) {
+		WRITE_ONCE(meta->drops, meta->drops + 1);
+		return;
+	}
+
+	/* The buffer after it was not programmed yet, CSI reuses this one */
+	if (meta->ring_armed == tail + 1) {
+		sun6i_meta_ring_arm(meta);
+		WRITE_ONCE(meta->drops, meta->drops + 1);
+		return;
+	}
+
+	buf = sun6i_meta_ring_slot(meta, tail);
+	buf->vb.vb2_buf.timestamp = ktime_get_ns();
+	/* Embedded data leads the image, it pairs with the frame in flight */
+	buf->vb.sequence = READ_ONCE(meta->csi->video.sequence);
+
+	/* Hand the buffer over to the IRQ thread. */
+	smp_store_release(&meta->ring_tail, tail + 1);
+
+	/* Prepare buffer for next frame but one. */
+	if (meta->ring_armed != head)
+		sun6i_meta_ring_arm(meta);
+}
+
+/*
+ * Threaded half of the channel 1 interrupt. Stopping the node clears
+ * @streaming and synchronizes the IRQ before flushing the ring, which
+ * keeps this the only consumer of ring_done while streaming.
+ */
+void sun6i_meta_complete(struct sun6i_meta *meta)
+{
+	if (!READ_ONCE(meta->streaming))
+		return;
+
+	sun6i_meta_complete_until(meta, smp_load_acquire(&meta->ring_tail));
+}
+
+bool sun6i_meta_complete_pending(struct sun6i_meta *meta)
+{
+	return READ_ONCE(meta->ring_done) != meta->ring_tail;
+}
+
+static const struct vb2_ops sun6i_meta_vb2_ops = {
+	.queue_setup		= sun6i_meta_queue_setup,
+	.wait_prepare		= vb2_ops_wait_prepare,
+	.wait_finish		= vb2_ops_wait_finish,
+	.buf_prepare		= sun6i_meta_buffer_prepare,
+	.start_streaming	= sun6i_meta_start_streaming,
+	.stop_streaming		= sun6i_meta_stop_streaming,
+	.buf_queue		= sun6i_meta_buffer_queue,
+};
+
+/* -----------------------------------------------------------------------------
+ * V4L2 ioctls
+ */
+static int sun6i_meta_querycap(struct file *file, void *priv,
+			       struct v4l2_capability *cap)
+{
+	struct sun6i_meta *meta = video_drvdata(file);
+
+	strscpy(cap->driver, "sun6i-video", sizeof(cap->driver));
+	strscpy(cap->card, meta->vdev.name, sizeof(cap->card));
+	snprintf(cap->bus_info, sizeof(cap->bus_info), "platform:%s",
+		 dev_name(meta->csi->dev));
+
+	return 0;
+}
+
+static int sun6i_meta_enum_fmt(struct file *file, void *priv,
+			       struct v4l2_fmtdesc *f)
+{
+	if (f->index)
+		return -EINVAL;
+
+	f->pixelformat = V4L2_META_FMT_SUN6I_RAW;
+	strscpy(f->description, "Sun6i CSI Raw Metadata",
+		sizeof(f->description));
+
+	return 0;
+}
+
+/* The layout comes from DT, G/S/TRY_FMT all return it. */
+static int sun6i_meta_g_fmt(struct file *file, void *priv,
+			    struct v4l2_format *f)
+{
+	struct sun6i_meta *meta = video_drvdata(file);
+
+	f->fmt.meta.dataformat = V4L2_META_FMT_SUN6I_RAW;
+	f->fmt.meta.buffersize = sun6i_meta_size(meta);
+
+	return 0;
+}
+
+static const struct v4l2_ioctl_ops sun6i_meta_ioctl_ops = {
+	.vidioc_querycap		= sun6i_meta_querycap,
+	.vidioc_enum_fmt_meta_cap	= sun6i_meta_enum_fmt,
+	.vidioc_g_fmt_meta_cap		= sun6i_meta_g_fmt,
+	.vidioc_s_fmt_meta_cap		= sun6i_meta_g_fmt,
+	.vidioc_try_fmt_meta_cap	= sun6i_meta_g_fmt,
+
+	.vidioc_reqbufs			= vb2_ioctl_reqbufs,
+	.vidioc_querybuf		= vb2_ioctl_querybuf,
+	.vidioc_qbuf			= vb2_ioctl_qbuf,
+	.vidioc_expbuf			= vb2_ioctl_expbuf,
+	.vidioc_dqbuf			= vb2_ioctl_dqbuf,
+	.vidioc_create_bufs		= vb2_ioctl_create_bufs,
+	.vidioc_prepare_buf		= vb2_ioctl_prepare_buf,
+	.vidioc_streamon		= vb2_ioctl_streamon,
+	.vidioc_streamoff		= vb2_ioctl_streamoff,
+
+	.vidioc_log_status		= v4l2_ctrl_log_status,
+	.vidioc_subscribe_event		= v4l2_ctrl_subscribe_event,
+	.vidioc_unsubscribe_event	= v4l2_event_unsubscribe,
+};
+
+static const struct v4l2_file_operations sun6i_meta_fops = {
+	.owner		= THIS_MODULE,
+	.open		= v4l2_fh_open,
+	.release	= vb2_fop_release,
+	.unlocked_ioctl	= video_ioctl2,
+	.mmap		= vb2_fop_mmap,
+	.poll		= vb2_fop_poll
+};
+
+/*
+ * allwinner,mipi-csi-meta = <vc dt bytesperline lines>. Without it, or
+ * on a parallel bus, there is no metadata node.
+ */
+static int sun6i_meta_parse_dt(struct sun6i_meta *meta)
+{
+	struct sun6i_csi *csi = meta->csi;
+	u32 cfg[4];
+
+	if (csi->v4l2_ep.bus_type != V4L2_MBUS_CSI2_DPHY ||
+	    of_property_read_u32_array(csi->dev->of_node,
+				       "allwinner,mipi-csi-meta",
+				       cfg, ARRAY_SIZE(cfg)))
+		return 0;
+
+	if (cfg[0] > 3 || cfg[1] > 0x3f ||
+	    !cfg[2] || cfg[2] > SUN6I_META_MAX_LEN ||
+	    !cfg[3] || cfg[3] > SUN6I_META_MAX_LEN) {
+		dev_err(csi->dev, "Invalid allwinner,mipi-csi-meta\n");
+		return -EINVAL;
+	}
+
+	meta->vc = cfg[0];
+	meta->dt = cfg[1];
+	meta->bytesperline = cfg[2];
+	meta->lines = cfg[3];
+
+	return 1;
+}
+
+int sun6i_meta_init(struct sun6i_meta *meta, struct sun6i_csi *csi,
+		    const char *name)
+{
+	struct video_device *vdev = &meta->vdev;
+	struct vb2_queue *vidq = &meta->vb2_vidq;
+	int ret;
+
+	meta->csi = csi;
+
+	ret = sun6i_meta_parse_dt(meta);
+	if (ret <= 0)
+		return ret;
+
+	meta->pad.flags = MEDIA_PAD_FL_SINK;
+	ret = media_entity_pads_init(&vdev->entity, 1, &meta->pad);
+	if (ret < 0)
+		return ret;
+
+	mutex_init(&meta->lock);
+
+	vidq->type			= V4L2_BUF_TYPE_META_CAPTURE;
+	vidq->io_modes			= VB2_MMAP | VB2_DMABUF;
+	vidq->drv_priv			= meta;
+	vidq->buf_struct_size		= sizeof(struct sun6i_meta_buffer);
+	vidq->ops			= &sun6i_meta_vb2_ops;
+	vidq->mem_ops			= &vb2_dma_contig_memops;
+	vidq->timestamp_flags		= V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC |
+					  V4L2_BUF_FLAG_TSTAMP_SRC_EOF;
+	vidq->lock			= &meta->lock;
+	/* Two buffers are handed to CSI at stream on */
+	vidq->min_buffers_needed	= 2;
+	vidq->dev			= csi->dev;
+
+	ret = vb2_queue_init(vidq);
+	if (ret) {
+		v4l2_err(&csi->v4l2_dev, "vb2_queue_init failed: %d\n", ret);
+		goto clean_entity;
+	}
+
+	strscpy(vdev->name, name, sizeof(vdev->name));
+	vdev->release		= video_device_release_empty;
+	vdev->fops		= &sun6i_meta_fops;
+	vdev->ioctl_ops		= &sun6i_meta_ioctl_ops;
+	vdev->vfl_type		= VFL_TYPE_VIDEO;
+	vdev->vfl_dir		= VFL_DIR_RX;
+	vdev->v4l2_dev		= &csi->v4l2_dev;
+	vdev->queue		= vidq;
+	vdev->lock		= &meta->lock;
+	vdev->device_caps	= V4L2_CAP_STREAMING | V4L2_CAP_META_CAPTURE;
+	video_set_drvdata(vdev, meta);
+
+	ret = video_register_device(vdev, VFL_TYPE_VIDEO, -1);
+	if (ret < 0) {
+		v4l2_err(&csi->v4l2_dev,
+			 "video_register_device failed: %d\n", ret);
+		goto release_vb2;
+	}
+
+	meta->registered = true;
+
+	return 0;
+
+release_vb2:
+	vb2_queue_release(&meta->vb2_vidq);
+clean_entity:
+	media_entity_cleanup(&vdev->entity);
+	mutex_destroy(&meta->lock);
+	return ret;
+}
+
+void sun6i_meta_cleanup(struct sun6i_meta *meta)
+{
+	if (!meta->registered)
+		return;
+
+	video_unregister_device(&meta->vdev);
+	media_entity_cleanup(&meta->vdev.entity);
+	vb2_queue_release(&meta->vb2_vidq);
+	mutex_destroy(&meta->lock);
+	meta->registered = false;
+}
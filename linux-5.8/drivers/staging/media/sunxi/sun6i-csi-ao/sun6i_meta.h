@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Copyright (c) 2020- Aodzip
+ * All rights reserved.
+ * Author: Aodzip <aodzip@gmail.com>
+ *
+ * Metadata capture node, fed by a second MIPI CSI-2 virtual channel or
+ * data type routed to CSI channel 1.
+ */
+
+#ifndef __SUN6I_META_H__
+#define __SUN6I_META_H__
+
+#include <media/v4l2-dev.h>
+#include <media/videobuf2-core.h>
+
+struct sun6i_csi;
+struct sun6i_meta_buffer;
+
+/* CSI channel the metadata stream is routed to */
+#define SUN6I_META_CSI_CH		1
+
+/* Size of the buffer ring, see SUN6I_VIDEO_RING_SIZE */
+#define SUN6I_META_RING_SIZE		VB2_MAX_FRAME
+
+/**
+ * struct sun6i_meta - metadata capture node
+ * @vdev:	video device node
+ * @pad:	sink pad, linked to the sensor
+ * @csi:	the csi the node belongs to
+ * @lock:	serializes the node's ioctls
+ * @vb2_vidq:	buffer queue of the node
+ * @vc:		virtual channel of the metadata packets
+ * @dt:		CSI-2 data type of the metadata packets
+ * @bytesperline: payload bytes per metadata line
+ * @lines:	metadata lines per frame
+ * @registered:	the node exists, allwinner,mipi-csi-meta is set in DT
+ * @ring:	buffers queued to the node, in capture order. A
+ *		single-producer/single-consumer ring indexed like the one of
+ *		struct sun6i_video: buffer_queue advances @ring_head, the
+ *		frame done ISR @ring_tail and @ring_armed, the IRQ thread
+ *		@ring_done.
+ * @ring_head:	next slot buffer_queue fills
+ * @ring_tail:	oldest slot handed to the CSI DMA
+ * @ring_armed:	oldest slot not yet handed to the CSI DMA
+ * @ring_done:	oldest filled slot not yet returned to vb2
+ * @streaming:	the ISR and the IRQ thread may touch the ring
+ * @drops:	frames lost for lack of queued buffers
+ */
+struct sun6i_meta {
+	struct video_device		vdev;
+	struct media_pad		pad;
+	struct sun6i_csi		*csi;
+
+	struct mutex			lock;
+	struct vb2_queue		vb2_vidq;
+
+	u8				vc;
+	u8				dt;
+	u32				bytesperline;
+	u32				lines;
+	bool				registered;
+
+	struct sun6i_meta_buffer	*ring[SUN6I_META_RING_SIZE];
+	unsigned int			ring_head;
+	unsigned int			ring_tail;
+	unsigned int			ring_armed;
+	unsigned int			ring_done;
+	bool				streaming;
+	u32				drops;
+};
+
+int sun6i_meta_init(struct sun6i_meta *meta, struct sun6i_csi *csi,
+		    const char *name);
+void sun6i_meta_cleanup(struct sun6i_meta *meta);
+
+void sun6i_meta_frame_done(struct sun6i_meta *meta);
+void sun6i_meta_complete(struct sun6i_meta *meta);
+bool sun6i_meta_complete_pending(struct sun6i_meta *meta);
+
+#endif /* __SUN6I_META_H__ */
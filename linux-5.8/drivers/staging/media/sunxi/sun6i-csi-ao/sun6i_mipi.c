@@ -6,104 +6,236 @@
  */
 #include "sun6i_mipi.h"
 #include "sun6i_mipi_reg.h"
+#include "sun6i_dphy_reg.h"
 #include <linux/regmap.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/of.h>
-#include <uapi/linux/media-bus-format.h>
+#include <media/v4l2-ctrls.h>
+#include <media/v4l2-subdev.h>
 #include "sun6i_dphy.h"
 
-enum pkt_fmt {
-	MIPI_FS = 0X00, /* short packet */
-	MIPI_FE = 0X01,
-	MIPI_LS = 0X02,
-	MIPI_LE = 0X03,
-	MIPI_SDAT0 = 0X08,
-	MIPI_SDAT1 = 0X09,
-	MIPI_SDAT2 = 0X0A,
-	MIPI_SDAT3 = 0X0B,
-	MIPI_SDAT4 = 0X0C,
-	MIPI_SDAT5 = 0X0D,
-	MIPI_SDAT6 = 0X0E,
-	MIPI_SDAT7 = 0X0F,
-	/* NULL          = 0X10, //long packet */
-	MIPI_BLK = 0X11,
-	MIPI_EMBD = 0X12,
-	MIPI_YUV420 = 0X18,
-	MIPI_YUV420_10 = 0X19,
-	MIPI_YUV420_CSP = 0X1C,
-	MIPI_YUV420_CSP_10 = 0X1D,
-	MIPI_YUV422 = 0X1E,
-	MIPI_YUV422_10 = 0X1F,
-	MIPI_RGB565 = 0X22,
-	MIPI_RGB888 = 0X24,
-	MIPI_RAW8 = 0X2A,
-	MIPI_RAW10 = 0X2B,
-	MIPI_RAW12 = 0X2C,
-	MIPI_USR_DAT0 = 0X30,
-	MIPI_USR_DAT1 = 0X31,
-	MIPI_USR_DAT2 = 0X32,
-	MIPI_USR_DAT3 = 0X33,
-	MIPI_USR_DAT4 = 0X34,
-	MIPI_USR_DAT5 = 0X35,
-	MIPI_USR_DAT6 = 0X36,
-	MIPI_USR_DAT7 = 0X37,
-};
+/* Measured and assumed lane rates this close are treated as equal */
+#define SUN6I_MIPI_BPS_TOLERANCE_PCT	5
 
 static inline struct sun6i_csi_dev *sun6i_csi_to_dev(struct sun6i_csi *csi)
 {
 	return container_of(csi, struct sun6i_csi_dev, csi);
 }
 
-static enum pkt_fmt get_pkt_fmt(u16 bus_pix_code)
+static struct v4l2_subdev *sun6i_mipi_remote_subdev(struct sun6i_csi *csi)
 {
-	switch (bus_pix_code) {
-	case MEDIA_BUS_FMT_RGB565_1X16:
-		return MIPI_RGB565;
-	case MEDIA_BUS_FMT_UYVY8_2X8:
-	case MEDIA_BUS_FMT_UYVY8_1X16:
-		return MIPI_YUV422;
-	case MEDIA_BUS_FMT_UYVY10_2X10:
-		return MIPI_YUV422_10;
-	case MEDIA_BUS_FMT_RGB888_1X24:
-		return MIPI_RGB888;
-	case MEDIA_BUS_FMT_SBGGR8_1X8:
-	case MEDIA_BUS_FMT_SGBRG8_1X8:
-	case MEDIA_BUS_FMT_SGRBG8_1X8:
-	case MEDIA_BUS_FMT_SRGGB8_1X8:
-		return MIPI_RAW8;
-	case MEDIA_BUS_FMT_SBGGR10_1X10:
-	case MEDIA_BUS_FMT_SGBRG10_1X10:
-	case MEDIA_BUS_FMT_SGRBG10_1X10:
-	case MEDIA_BUS_FMT_SRGGB10_1X10:
-		return MIPI_RAW10;
-	case MEDIA_BUS_FMT_SBGGR12_1X12:
-	case MEDIA_BUS_FMT_SGBRG12_1X12:
-	case MEDIA_BUS_FMT_SGRBG12_1X12:
-	case MEDIA_BUS_FMT_SRGGB12_1X12:
-		return MIPI_RAW12;
-	default:
-		return MIPI_RAW8;
+	struct media_pad *remote = media_entity_remote_pad(&csi->video.pad);
+
+	if (!remote || !is_media_entity_v4l2_subdev(remote->entity))
+		return NULL;
+
+	return media_entity_to_v4l2_subdev(remote->entity);
+}
+
+/* Bits per pixel on the wire for a CSI-2 data type */
+static unsigned int sun6i_mipi_dt_bpp(u8 dt)
+{
+	switch (dt) {
+	case MIPI_RAW8:
+		return 8;
+	case MIPI_RAW10:
+		return 10;
+	case MIPI_RAW12:
+		return 12;
+	case MIPI_RGB888:
+		return 24;
+	default: /* 8bit YUV422, RGB565 */
+		return 16;
 	}
 }
 
-void sun6i_mipi_set_stream(struct sun6i_csi *csi, bool enable)
+/*
+ * Data lanes the sensor drives: the most it supports among those the
+ * endpoint wires up. Sensors without g_mbus_config use them all.
+ */
+static unsigned int sun6i_mipi_lanes(struct sun6i_csi *csi,
+				     struct v4l2_subdev *sd)
+{
+	unsigned int lanes = csi->v4l2_ep.bus.mipi_csi2.num_data_lanes;
+	struct v4l2_mbus_config cfg;
+	unsigned int n;
+
+	if (!sd || v4l2_subdev_call(sd, video, g_mbus_config, &cfg) ||
+	    cfg.type != V4L2_MBUS_CSI2_DPHY)
+		return lanes;
+
+	for (n = lanes; n > 0; n--)
+		if (cfg.flags & (V4L2_MBUS_CSI2_1_LANE << (n - 1)))
+			return n;
+
+	return lanes;
+}
+
+/*
+ * Lane rate the sensor advertises, in bps, the way v4l2_get_link_freq()
+ * of later kernels negotiates it: V4L2_CID_LINK_FREQ if the sensor has
+ * it, else derived from V4L2_CID_PIXEL_RATE. 0 if it exports neither.
+ */
+static u64 sun6i_mipi_sensor_bps(struct v4l2_subdev *sd, unsigned int bpp,
+				 unsigned int lanes)
+{
+	struct v4l2_querymenu qm = { .id = V4L2_CID_LINK_FREQ };
+	struct v4l2_ctrl *ctrl;
+	s64 rate;
+
+	if (!sd)
+		return 0;
+
+	ctrl = v4l2_ctrl_find(sd->ctrl_handler, V4L2_CID_LINK_FREQ);
+	if (ctrl) {
+		qm.index = v4l2_ctrl_g_ctrl(ctrl);
+		/* DDR: two bits per lane in each link clock cycle */
+		if (!v4l2_querymenu(sd->ctrl_handler, &qm) && qm.value > 0)
+			return qm.value * 2;
+	}
+
+	ctrl = v4l2_ctrl_find(sd->ctrl_handler, V4L2_CID_PIXEL_RATE);
+	if (ctrl) {
+		rate = v4l2_ctrl_g_ctrl_int64(ctrl);
+		if (rate > 0)
+			return div_u64(rate * bpp, lanes);
+	}
+
+	return 0;
+}
+
+/*
+ * Pixels per second the sensor sends: V4L2_CID_PIXEL_RATE, else the
+ * active area at the current frame interval. 0 if unknown.
+ */
+static u64 sun6i_mipi_pixel_rate(struct v4l2_subdev *sd, u32 width,
+				 u32 height)
+{
+	struct v4l2_subdev_frame_interval fi = { 0 };
+	struct v4l2_ctrl *ctrl;
+	s64 rate;
+
+	ctrl = v4l2_ctrl_find(sd->ctrl_handler, V4L2_CID_PIXEL_RATE);
+	if (ctrl) {
+		rate = v4l2_ctrl_g_ctrl_int64(ctrl);
+		if (rate > 0)
+			return rate;
+	}
+
+	if (v4l2_subdev_call(sd, video, g_frame_interval, &fi) ||
+	    !fi.interval.numerator)
+		return 0;
+
+	return div_u64((u64)width * height * fi.interval.denominator,
+		       fi.interval.numerator);
+}
+
+static void sun6i_mipi_set_lane_rate(struct sun6i_csi *csi, u32 bps,
+				     const char *src)
 {
 	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
 
-	if (enable) {
-		regmap_write_bits(sdev->regmap, MIPI_CSI2_CTL_REG,
-				  MIPI_CSI2_CTL_RST, MIPI_CSI2_CTL_RST);
-		regmap_write_bits(sdev->regmap, MIPI_CSI2_CTL_REG,
-				  MIPI_CSI2_CTL_EN, MIPI_CSI2_CTL_EN);
-		usleep_range(10000, 12000);
+	if (csi->stats.lane_rate != bps || csi->stats.lane_rate_src != src)
+		dev_info(sdev->dev, "MIPI lane rate %u bps (%s)\n", bps, src);
+
+	WRITE_ONCE(csi->stats.lane_rate, bps);
+	WRITE_ONCE(csi->stats.lane_rate_src, src);
+}
+
+void sun6i_mipi_set_state(struct sun6i_csi *csi, enum sun6i_mipi_state state)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	enum sun6i_mipi_state old = sdev->mipi_state;
+	ktime_t start = ktime_get();
+
+	if (state == old)
+		return;
+
+	switch (state) {
+	case SUN6I_MIPI_ON:
+		/* Out of idle the controller and analog front-end are up */
+		if (old == SUN6I_MIPI_OFF) {
+			regmap_write_bits(sdev->regmap, MIPI_CSI2_CTL_REG,
+					  MIPI_CSI2_CTL_RST, MIPI_CSI2_CTL_RST);
+			regmap_write_bits(sdev->regmap, MIPI_CSI2_CTL_REG,
+					  MIPI_CSI2_CTL_EN, MIPI_CSI2_CTL_EN);
+			usleep_range(10000, 12000);
+		}
+		/* Errors from before the restart are not this stream's */
+		regmap_write(sdev->regmap, MIPI_CSI2_CH_INT_PD_REG,
+			     MIPI_CSI2_CH_INT_ERR_MASK);
 		sun6i_dphy_enable(sdev);
-	} else {
-		sun6i_dphy_disable(sdev);
+
+		WRITE_ONCE(csi->stats.mipi_resume_us,
+			   ktime_us_delta(ktime_get(), start));
+		WRITE_ONCE(csi->stats.mipi_resume_src,
+			   old == SUN6I_MIPI_IDLE ? "idle" : "off");
+		break;
+	case SUN6I_MIPI_IDLE:
+		/* Only a running receiver idles, anything else stays off */
+		if (old != SUN6I_MIPI_ON)
+			return;
+		sun6i_dphy_idle(sdev);
+		break;
+	case SUN6I_MIPI_OFF:
+		if (old == SUN6I_MIPI_ON)
+			sun6i_dphy_idle(sdev);
+		sun6i_dphy_ana_exit(sdev->regmap);
 		regmap_write_bits(sdev->regmap, MIPI_CSI2_CTL_REG,
 				  MIPI_CSI2_CTL_EN, 0);
 		regmap_write_bits(sdev->regmap, MIPI_CSI2_CTL_REG,
 				  MIPI_CSI2_CTL_RST, 0);
+		/*
+		 * Whatever the controller reset clears, the cache must not
+		 * claim it still holds: read it back from the hardware on
+		 * the next setup.
+		 */
+		regcache_drop_region(sdev->regmap, MIPI_CSI2_OFFSET,
+				     DPHY_ANA4_REG);
+		break;
 	}
+
+	sdev->mipi_state = state;
+}
+
+/* Lane rate for a sensor that does not tell: from DT, else a default */
+static u32 sun6i_mipi_fallback_bps(struct sun6i_csi_dev *sdev,
+				   const char **src)
+{
+	u32 bps;
+
+	*src = "dt";
+	if (!of_property_read_u32(sdev->dev->of_node, "allwinner,mipi-csi-bps",
+				  &bps))
+		return bps;
+
+	*src = "default";
+	return 400 * 1000 * 1000;
+}
+
+/*
+ * Lanes and lane rate to set the DPHY up for: what the sensor
+ * negotiates, else allwinner,mipi-csi-bps from DT, else a default.
+ */
+void sun6i_mipi_negotiate(struct sun6i_csi *csi,
+			  const struct sun6i_csi_format *fmt,
+			  struct sun6i_csi_config *config)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	struct v4l2_subdev *sd = sun6i_mipi_remote_subdev(csi);
+
+	config->lanes = sun6i_mipi_lanes(csi, sd);
+	config->lane_bps = min_t(u64, DPHY_MAX_BPS,
+				 sun6i_mipi_sensor_bps(sd,
+					sun6i_mipi_dt_bpp(fmt->mipi_dt),
+					config->lanes));
+	config->lane_bps_src = "sensor";
+	if (config->lane_bps)
+		return;
+
+	config->lane_bps = sun6i_mipi_fallback_bps(sdev, &config->lane_bps_src);
 }
 
 void sun6i_mipi_setup_bus(struct sun6i_csi *csi)
@@ -111,7 +243,7 @@ void sun6i_mipi_setup_bus(struct sun6i_csi *csi)
 	struct v4l2_fwnode_endpoint *endpoint = &csi->v4l2_ep;
 	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
 	struct sun6i_dphy_param dphy_param = { 0 };
-	int lane_num = endpoint->bus.mipi_csi2.num_data_lanes;
+	int lane_num = csi->config.lanes;
 	bool input_interlaced = false;
 
 	if (csi->config.field == V4L2_FIELD_INTERLACED ||
@@ -119,31 +251,153 @@ void sun6i_mipi_setup_bus(struct sun6i_csi *csi)
 	    csi->config.field == V4L2_FIELD_INTERLACED_BT)
 		input_interlaced = true;
 
-	regmap_write_bits(sdev->regmap, MIPI_CSI2_CFG_REG, MIPI_CSI2_CFG_DL_CFG,
-			  (lane_num - 1) << MIPI_CSI2_CFG_DL_CFG_SHIFT);
-	regmap_write_bits(sdev->regmap, MIPI_CSI2_CFG_REG, MIPI_CSI2_CFG_CH_MOD,
-			  0);
-	regmap_write_bits(sdev->regmap, MIPI_CSI2_VCDT_RX_REG,
+	/* CH_MOD is the number of VC/DT filters in use, minus one */
+	regmap_update_bits(sdev->regmap, MIPI_CSI2_CFG_REG,
+			   MIPI_CSI2_CFG_DL_CFG | MIPI_CSI2_CFG_CH_MOD,
+			   ((lane_num - 1) << MIPI_CSI2_CFG_DL_CFG_SHIFT) |
+			   ((csi->meta.registered ? 1 : 0) <<
+			    MIPI_CSI2_CFG_CH_MOD_SHIFT));
+	regmap_update_bits(sdev->regmap, MIPI_CSI2_VCDT_RX_REG,
 			  MIPI_CSI2_VCDT_RX_REG_CH_MASK(0),
 			  MIPI_CSI2_VCDT_RX_REG_CH_CONF(
-				  0, get_pkt_fmt(csi->config.code)));
+				  0, csi->fmt->mipi_dt));
+	if (csi->meta.registered)
+		regmap_update_bits(sdev->regmap, MIPI_CSI2_VCDT_RX_REG,
+				   MIPI_CSI2_VCDT_RX_REG_CH_MASK(
+					   SUN6I_META_CSI_CH),
+				   MIPI_CSI2_VCDT_RX_REG_CH_DATA(
+					   MIPI_CSI2_VCDT_RX_REG_VCDT(
+						   csi->meta.vc, csi->meta.dt),
+					   SUN6I_META_CSI_CH));
 
 	if (input_interlaced) {
-		regmap_write_bits(sdev->regmap, MIPI_CSI2_CH_CFG_REG,
-				  MIPI_CSI2_CH_CFG_SRC_SEL,
-				  MIPI_CSI2_CH_CFG_SRC_SEL);
+		regmap_update_bits(sdev->regmap, MIPI_CSI2_CH_CFG_REG,
+				   MIPI_CSI2_CH_CFG_SRC_SEL,
+				   MIPI_CSI2_CH_CFG_SRC_SEL);
 	} else {
-		regmap_write_bits(sdev->regmap, MIPI_CSI2_CH_CFG_REG,
-				  MIPI_CSI2_CH_CFG_SRC_SEL, 0);
+		regmap_update_bits(sdev->regmap, MIPI_CSI2_CH_CFG_REG,
+				   MIPI_CSI2_CH_CFG_SRC_SEL, 0);
 	}
 
+	/*
+	 * The frequency counter needs the sensor running, so start from
+	 * what the sensor or DT claims and calibrate after stream on.
+	 */
 	dphy_param.lane_num = lane_num;
-	if (of_property_read_u32(sdev->dev->of_node, "allwinner,mipi-csi-bps",
-				 &dphy_param.bps)) {
-		dphy_param.bps = 400 * 1000 * 1000;
-		dev_warn(sdev->dev,
-			 "Using default allwinner,mipi-csi-bps: %u\n",
-			 dphy_param.bps);
-	}
+	dphy_param.bps = csi->config.lane_bps;
+	sun6i_mipi_set_lane_rate(csi, dphy_param.bps,
+				 csi->config.lane_bps_src);
 	sun6i_dphy_set_param(sdev, &dphy_param);
+	sdev->lane_rate_checked = false;
+}
+
+u32 sun6i_mipi_poll_errors(struct sun6i_csi *csi)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	struct sun6i_csi_stats *stats = &csi->stats;
+	u32 pd;
+
+	regmap_read(sdev->regmap, MIPI_CSI2_CH_INT_PD_REG, &pd);
+	pd &= MIPI_CSI2_CH_INT_ERR_MASK;
+	if (!pd)
+		return 0;
+
+	regmap_write(sdev->regmap, MIPI_CSI2_CH_INT_PD_REG, pd);
+
+	/*
+	 * The bits only say an error happened since the last poll, so
+	 * each counts at most once per frame.
+	 */
+	if (pd & MIPI_CSI2_CH_INT_ECC_WRN)
+		sun6i_csi_stats_inc(stats->mipi_ecc_fix);
+	if (pd & MIPI_CSI2_CH_INT_ECC_ERR)
+		sun6i_csi_stats_inc(stats->mipi_ecc_err);
+	if (pd & MIPI_CSI2_CH_INT_CHKSUM_ERR)
+		sun6i_csi_stats_inc(stats->mipi_crc_err);
+	if (pd & MIPI_CSI2_CH_INT_FRAME_SYNC_ERR)
+		sun6i_csi_stats_inc(stats->mipi_frame_sync_err);
+	if (pd & MIPI_CSI2_CH_INT_LINE_SYNC_ERR)
+		sun6i_csi_stats_inc(stats->mipi_line_sync_err);
+	if (pd & MIPI_CSI2_CH_INT_EOT_ERR)
+		sun6i_csi_stats_inc(stats->mipi_eot_err);
+	if (pd & MIPI_CSI2_CH_INT_FIFO_OVER)
+		sun6i_csi_stats_inc(stats->mipi_fifo_of);
+
+	return pd;
+}
+
+int sun6i_mipi_check_bandwidth(struct sun6i_csi *csi, struct v4l2_subdev *sd,
+			       const struct sun6i_csi_format *fmt,
+			       u32 width, u32 height)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	unsigned int bpp = sun6i_mipi_dt_bpp(fmt->mipi_dt);
+	unsigned int lanes = sun6i_mipi_lanes(csi, sd);
+	u64 lane_bps = sun6i_mipi_sensor_bps(sd, bpp, lanes);
+	const char *src = "sensor";
+	u64 need;
+
+	if (lane_bps > DPHY_MAX_BPS) {
+		dev_err(csi->dev, "Lane rate %llu bps above the DPHY's %u\n",
+			lane_bps, DPHY_MAX_BPS);
+		return -EPIPE;
+	}
+
+	need = sun6i_mipi_pixel_rate(sd, width, height) * bpp;
+	if (!need) {
+		dev_dbg(csi->dev,
+			"%ux%u: sensor rate unknown, bandwidth not checked\n",
+			width, height);
+		return 0;
+	}
+
+	/* Else the rate sun6i_mipi_negotiate() sets the DPHY up for */
+	if (!lane_bps)
+		lane_bps = sun6i_mipi_fallback_bps(sdev, &src);
+
+	if (need > lane_bps * lanes) {
+		dev_err(csi->dev,
+			"%ux%u needs %llu bps, %u lanes carry %llu (%s)\n",
+			width, height, need, lanes, lane_bps * lanes, src);
+		return -EPIPE;
+	}
+
+	return 0;
+}
+
+void sun6i_mipi_calibrate(struct sun6i_csi *csi)
+{
+	struct sun6i_csi_dev *sdev = sun6i_csi_to_dev(csi);
+	u32 cur = csi->stats.lane_rate;
+	u32 bps;
+
+	/* Once per DPHY setup, a warm restart keeps the timing */
+	if (sdev->lane_rate_checked)
+		return;
+	sdev->lane_rate_checked = true;
+
+	bps = sun6i_dphy_det_mipi_clk(sdev);
+	if (!bps) {
+		dev_dbg(sdev->dev, "No lane clock measured, keeping %u bps\n",
+			cur);
+		return;
+	}
+
+	if (abs((s64)bps - cur) * 100 <=
+	    (s64)cur * SUN6I_MIPI_BPS_TOLERANCE_PCT)
+		return;
+
+	/*
+	 * The receiver must not sample the lanes while their timing
+	 * changes: stop the DPHY across the rewrite, the lanes resync on
+	 * the next start of transmission. The frame in flight, received
+	 * with the wrong timing anyway, is lost, and so are its errors.
+	 */
+	sun6i_dphy_idle(sdev);
+	sun6i_dphy_set_timing(sdev->regmap, bps);
+	sun6i_dphy_enable(sdev);
+	regmap_write(sdev->regmap, MIPI_CSI2_CH_INT_PD_REG,
+		     MIPI_CSI2_CH_INT_ERR_MASK);
+
+	sun6i_mipi_set_lane_rate(csi, bps, "measured");
 }
@@ -10,7 +10,28 @@
 #include <linux/regmap.h>
 #include "sun6i_csi.h"
 
-void sun6i_mipi_set_stream(struct sun6i_csi *csi, bool enable);
+/*
+ * Move the receiver between off, low-power idle and running. Idle keeps
+ * the controller and the DPHY analog front-end powered with the DPHY
+ * stopped, so going back to running skips the analog and controller
+ * bring-up. Reprogramming the bus needs a pass through off.
+ */
+void sun6i_mipi_set_state(struct sun6i_csi *csi, enum sun6i_mipi_state state);
 void sun6i_mipi_setup_bus(struct sun6i_csi *csi);
+void sun6i_mipi_negotiate(struct sun6i_csi *csi,
+			  const struct sun6i_csi_format *fmt,
+			  struct sun6i_csi_config *config);
+void sun6i_mipi_calibrate(struct sun6i_csi *csi);
+
+/*
+ * Fold the errors the receiver latched since the last call into the
+ * stats and clear them. The V3s has no interrupt line for the MIPI
+ * controller, so this is polled from the CSI frame done. Returns the
+ * MIPI_CSI2_CH_INT_* bits that were pending.
+ */
+u32 sun6i_mipi_poll_errors(struct sun6i_csi *csi);
+int sun6i_mipi_check_bandwidth(struct sun6i_csi *csi, struct v4l2_subdev *sd,
+			       const struct sun6i_csi_format *fmt,
+			       u32 width, u32 height);
 
 #endif /* __SUN6I_MIPI_H__ */
\ No newline at end of file
@@ -30,9 +30,64 @@
 #define MIPI_CSI2_VCDT_RX_REG_CH_CONF(ch, dt) (MIPI_CSI2_VCDT_RX_REG_CH_DATA(MIPI_CSI2_VCDT_RX_REG_VCDT(ch, dt), ch))
 /* MIPI_CSI2_VCDT_RX_REG */
 
+/* MIPI CSI-2 data types, as programmed in MIPI_CSI2_VCDT_RX_REG */
+enum pkt_fmt {
+	MIPI_FS = 0X00, /* short packet */
+	MIPI_FE = 0X01,
+	MIPI_LS = 0X02,
+	MIPI_LE = 0X03,
+	MIPI_SDAT0 = 0X08,
+	MIPI_SDAT1 = 0X09,
+	MIPI_SDAT2 = 0X0A,
+	MIPI_SDAT3 = 0X0B,
+	MIPI_SDAT4 = 0X0C,
+	MIPI_SDAT5 = 0X0D,
+	MIPI_SDAT6 = 0X0E,
+	MIPI_SDAT7 = 0X0F,
+	/* NULL          = 0X10, //long packet */
+	MIPI_BLK = 0X11,
+	MIPI_EMBD = 0X12,
+	MIPI_YUV420 = 0X18,
+	MIPI_YUV420_10 = 0X19,
+	MIPI_YUV420_CSP = 0X1C,
+	MIPI_YUV420_CSP_10 = 0X1D,
+	MIPI_YUV422 = 0X1E,
+	MIPI_YUV422_10 = 0X1F,
+	MIPI_RGB565 = 0X22,
+	MIPI_RGB888 = 0X24,
+	MIPI_RAW8 = 0X2A,
+	MIPI_RAW10 = 0X2B,
+	MIPI_RAW12 = 0X2C,
+	MIPI_USR_DAT0 = 0X30,
+	MIPI_USR_DAT1 = 0X31,
+	MIPI_USR_DAT2 = 0X32,
+	MIPI_USR_DAT3 = 0X33,
+	MIPI_USR_DAT4 = 0X34,
+	MIPI_USR_DAT5 = 0X35,
+	MIPI_USR_DAT6 = 0X36,
+	MIPI_USR_DAT7 = 0X37,
+};
+
 #define MIPI_CSI2_CH_CFG_REG (MIPI_CSI2_OFFSET + 0x0040)
 #define MIPI_CSI2_CH_CFG_SRC_SEL BIT(3)
 
 /* MIPI_CSI2_CH_CFG_REG */
 
+/*
+ * Channel 0 interrupt enable and pending registers, laid out as in the
+ * vendor BSP. The pending bits latch whether or not they are enabled
+ * and are cleared by writing 1.
+ */
+#define MIPI_CSI2_CH_INT_EN_REG (MIPI_CSI2_OFFSET + 0x0050)
+#define MIPI_CSI2_CH_INT_PD_REG (MIPI_CSI2_OFFSET + 0x0058)
+#define MIPI_CSI2_CH_INT_FIFO_OVER BIT(0)
+#define MIPI_CSI2_CH_INT_FRAME_SYNC_ERR BIT(16)
+#define MIPI_CSI2_CH_INT_LINE_SYNC_ERR BIT(17)
+#define MIPI_CSI2_CH_INT_ECC_ERR BIT(18)
+#define MIPI_CSI2_CH_INT_ECC_WRN BIT(19)
+#define MIPI_CSI2_CH_INT_CHKSUM_ERR BIT(20)
+#define MIPI_CSI2_CH_INT_EOT_ERR BIT(21)
+#define MIPI_CSI2_CH_INT_ERR_MASK (MIPI_CSI2_CH_INT_FIFO_OVER | GENMASK(21, 16))
+/* MIPI_CSI2_CH_INT_EN_REG, MIPI_CSI2_CH_INT_PD_REG */
+
 #endif /* __SUN6I_MIPI_REG_H__ */
\ No newline at end of file
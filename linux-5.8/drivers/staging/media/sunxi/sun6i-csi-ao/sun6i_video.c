@@ -5,17 +5,25 @@
  * Author: Yong Deng <yong.deng@magewell.com>
  */
 
+#include <linux/dma-mapping.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/module.h>
 #include <linux/of.h>
+#include <linux/vmalloc.h>
+#include <linux/vmstat.h>
 
 #include <media/v4l2-device.h>
 #include <media/v4l2-event.h>
 #include <media/v4l2-ioctl.h>
 #include <media/v4l2-mc.h>
+#include <media/v4l2-rect.h>
 #include <media/videobuf2-dma-contig.h>
 #include <media/videobuf2-v4l2.h>
 #include <uapi/linux/videodev2.h>
 
 #include "sun6i_csi.h"
+#include "sun6i_csi_trace.h"
 #include "sun6i_video.h"
 
 /* This is got from BSP sources. */
@@ -24,54 +32,93 @@
 #define MAX_WIDTH	(4800)
 #define MAX_HEIGHT	(4800)
 
+/*
+ * One buffer being written, one armed for the next frame and one with
+ * userspace, so that a late QBUF does not drop a frame.
+ */
+#define SUN6I_VIDEO_MIN_BUFFERS		3
+
+/* Lines a slice event is held back to cover the DMA write latency */
+#define SUN6I_VIDEO_SLICE_MARGIN	8
+/* Slice events queued per file handle */
+#define SUN6I_VIDEO_SLICE_EVENTS	16
+
+/* Test pattern generator frame rate range, in frames per second */
+#define SUN6I_VIDEO_TPG_MAX_RATE	1000
+#define SUN6I_VIDEO_TPG_DEF_RATE	30
+
+static bool mplane;
+module_param(mplane, bool, 0444);
+MODULE_PARM_DESC(mplane, "Use the multi-planar API on the video node");
+
 struct sun6i_csi_buffer {
 	struct vb2_v4l2_buffer		vb;
-	struct list_head		list;
 
-	dma_addr_t			dma_addr;
-	bool				queued_to_csi;
+	dma_addr_t			dma_addr[SUN6I_CSI_MAX_PLANES];
+	/* set when retired by the hard IRQ handler */
+	enum vb2_buffer_state		state;
 };
 
-static const u32 supported_pixformats[] = {
-	V4L2_PIX_FMT_SBGGR8,
-	V4L2_PIX_FMT_SGBRG8,
-	V4L2_PIX_FMT_SGRBG8,
-	V4L2_PIX_FMT_SRGGB8,
-	V4L2_PIX_FMT_SBGGR10,
-	V4L2_PIX_FMT_SGBRG10,
-	V4L2_PIX_FMT_SGRBG10,
-	V4L2_PIX_FMT_SRGGB10,
-	V4L2_PIX_FMT_SBGGR12,
-	V4L2_PIX_FMT_SGBRG12,
-	V4L2_PIX_FMT_SGRBG12,
-	V4L2_PIX_FMT_SRGGB12,
-	V4L2_PIX_FMT_YUYV,
-	V4L2_PIX_FMT_YVYU,
-	V4L2_PIX_FMT_UYVY,
-	V4L2_PIX_FMT_VYUY,
-	V4L2_PIX_FMT_NV12,
-	V4L2_PIX_FMT_NV21,
-	V4L2_PIX_FMT_YUV420,
-	V4L2_PIX_FMT_YVU420,
-	V4L2_PIX_FMT_NV16,
-	V4L2_PIX_FMT_NV61,
-	V4L2_PIX_FMT_YUV422P,
-	V4L2_PIX_FMT_RGB565,
-	V4L2_PIX_FMT_RGB565X,
-	V4L2_PIX_FMT_JPEG,
+/*
+ * Formats only available through the multi-planar API, with one memory
+ * plane per CSI output plane, and the single buffer format CSI is
+ * configured with for each of them.
+ */
+static const struct {
+	u32	mplane;
+	u32	contig;
+} sun6i_video_mplane_formats[] = {
+	{ V4L2_PIX_FMT_NV12M,	V4L2_PIX_FMT_NV12 },
+	{ V4L2_PIX_FMT_NV21M,	V4L2_PIX_FMT_NV21 },
+	{ V4L2_PIX_FMT_NV16M,	V4L2_PIX_FMT_NV16 },
+	{ V4L2_PIX_FMT_NV61M,	V4L2_PIX_FMT_NV61 },
+	{ V4L2_PIX_FMT_YUV420M,	V4L2_PIX_FMT_YUV420 },
+	{ V4L2_PIX_FMT_YVU420M,	V4L2_PIX_FMT_YVU420 },
+	{ V4L2_PIX_FMT_YUV422M,	V4L2_PIX_FMT_YUV422P },
 };
 
-static bool is_pixformat_valid(unsigned int pixformat)
+static bool is_pixformat_valid(struct sun6i_video *video,
+			       unsigned int pixformat)
 {
 	unsigned int i;
 
-	for (i = 0; i < ARRAY_SIZE(supported_pixformats); i++)
-		if (supported_pixformats[i] == pixformat)
-			return true;
+	if (sun6i_csi_find_format(pixformat, 0))
+		return true;
+
+	if (!video->mplane)
+		return false;
+
+	for (i = 0; i < ARRAY_SIZE(sun6i_video_mplane_formats); i++)
+		if (sun6i_video_mplane_formats[i].mplane == pixformat)
+			return sun6i_csi_find_format(
+				sun6i_video_mplane_formats[i].contig, 0);
 
 	return false;
 }
 
+/* Get the pixformat CSI has to be configured with for @pixformat */
+static u32 sun6i_video_csi_pixformat(u32 pixformat)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(sun6i_video_mplane_formats); i++)
+		if (sun6i_video_mplane_formats[i].mplane == pixformat)
+			return sun6i_video_mplane_formats[i].contig;
+
+	return pixformat;
+}
+
+static unsigned int sun6i_video_frame_size(struct sun6i_video *video)
+{
+	unsigned int size = 0;
+	unsigned int i;
+
+	for (i = 0; i < video->fmt.num_planes; i++)
+		size += video->fmt.plane_fmt[i].sizeimage;
+
+	return size;
+}
+
 static struct v4l2_subdev *
 sun6i_video_remote_subdev(struct sun6i_video *video, u32 *pad)
 {
@@ -88,6 +135,97 @@ sun6i_video_remote_subdev(struct sun6i_video *video, u32 *pad)
 	return media_entity_to_v4l2_subdev(remote->entity);
 }
 
+/* -----------------------------------------------------------------------------
+ * Buffer ring
+ */
+static struct sun6i_csi_buffer *
+sun6i_video_ring_slot(struct sun6i_video *video, unsigned int index)
+{
+	return video->ring[index & (SUN6I_VIDEO_RING_SIZE - 1)];
+}
+
+/* Hand the oldest not yet programmed buffer to the CSI DMA. */
+static void sun6i_video_ring_arm(struct sun6i_video *video)
+{
+	struct sun6i_csi_buffer *buf;
+
+	buf = sun6i_video_ring_slot(video, video->ring_armed);
+	sun6i_csi_update_buf_addr(video->csi, buf->dma_addr,
+				  video->fmt.num_planes);
+	video->ring_armed++;
+}
+
+/* Give every buffer left in the ring back to vb2. CSI must be stopped. */
+static void sun6i_video_ring_flush(struct sun6i_video *video,
+				   enum vb2_buffer_state state)
+{
+	unsigned int head = smp_load_acquire(&video->ring_head);
+	struct sun6i_csi_buffer *buf;
+
+	/* Frames retired before the IRQ was stopped keep their state. */
+	sun6i_video_complete(video);
+
+	while (video->ring_done != head) {
+		buf = sun6i_video_ring_slot(video, video->ring_done);
+		smp_store_release(&video->ring_done, video->ring_done + 1);
+		vb2_buffer_done(&buf->vb.vb2_buf, state);
+	}
+
+	video->ring_tail = video->ring_done;
+	video->ring_armed = video->ring_done;
+}
+
+static int sun6i_video_scratch_alloc(struct sun6i_video *video)
+{
+	/* Always programmed as one buffer, laid out by planar_offset[] */
+	video->scratch_size = sun6i_video_frame_size(video);
+	video->scratch_cookie = dma_alloc_attrs(video->csi->dev,
+						video->scratch_size,
+						&video->scratch_dma, GFP_KERNEL,
+						DMA_ATTR_NO_KERNEL_MAPPING);
+	if (!video->scratch_cookie)
+		return -ENOMEM;
+
+	video->scratch_cur = false;
+	video->scratch_next = false;
+
+	return 0;
+}
+
+static void sun6i_video_scratch_free(struct sun6i_video *video)
+{
+	if (!video->scratch_cookie)
+		return;
+
+	dma_free_attrs(video->csi->dev, video->scratch_size,
+		       video->scratch_cookie, video->scratch_dma,
+		       DMA_ATTR_NO_KERNEL_MAPPING);
+	video->scratch_cookie = NULL;
+}
+
+/*
+ * Number of @size buffers that still fit in the free CMA, once the
+ * recycle mode scratch frame and a quarter left to the rest of the system
+ * are taken out, 0 when CMA is exhausted. Without CMA the count is left
+ * to vb2, which allocates what it can and sizes the queue down to that.
+ */
+static unsigned int sun6i_video_cma_buffers(struct sun6i_video *video,
+					    unsigned long size)
+{
+#ifdef CONFIG_DMA_CMA
+	unsigned long free;
+
+	free = global_zone_page_state(NR_FREE_CMA_PAGES) << PAGE_SHIFT;
+	free -= free / 4;
+	if (!video->scratch_cookie && v4l2_ctrl_g_ctrl(video->recycle_ctrl))
+		free -= min(free, PAGE_ALIGN(sun6i_video_frame_size(video)));
+
+	return min_t(unsigned long, free / PAGE_ALIGN(size), VB2_MAX_FRAME);
+#else
+	return VB2_MAX_FRAME;
+#endif
+}
+
 static int sun6i_video_queue_setup(struct vb2_queue *vq,
 				   unsigned int *nbuffers,
 				   unsigned int *nplanes,
@@ -95,13 +233,50 @@ static int sun6i_video_queue_setup(struct vb2_queue *vq,
 				   struct device *alloc_devs[])
 {
 	struct sun6i_video *video = vb2_get_drv_priv(vq);
-	unsigned int size = video->fmt.fmt.pix.sizeimage;
+	struct v4l2_pix_format_mplane *pixfmt = &video->fmt;
+	unsigned long size = 0;
+	unsigned int count;
+	unsigned int i;
 
-	if (*nplanes)
-		return sizes[0] < size ? -EINVAL : 0;
+	if (*nplanes) {
+		/* VIDIOC_CREATE_BUFS, possibly growing the pool mid-stream */
+		if (*nplanes != pixfmt->num_planes)
+			return -EINVAL;
+
+		for (i = 0; i < pixfmt->num_planes; i++) {
+			if (sizes[i] < pixfmt->plane_fmt[i].sizeimage)
+				return -EINVAL;
+			size += sizes[i];
+		}
+	} else {
+		*nplanes = pixfmt->num_planes;
+		for (i = 0; i < pixfmt->num_planes; i++) {
+			sizes[i] = pixfmt->plane_fmt[i].sizeimage;
+			size += sizes[i];
+		}
+	}
+
+	if (!size)
+		return -EINVAL;
 
-	*nplanes = 1;
-	sizes[0] = size;
+	/* Imported buffers are not allocated from our CMA */
+	if (vq->memory != VB2_MEMORY_MMAP)
+		return 0;
+
+	count = sun6i_video_cma_buffers(video, size);
+	if (*nbuffers > count) {
+		dev_dbg(video->csi->dev,
+			"%u buffers of %lu bytes asked, %u fit in CMA\n",
+			*nbuffers, size, count);
+		/*
+		 * REQBUFS fails below min_buffers_needed anyway, let it try
+		 * the minimum. CREATE_BUFS gets what fits, -ENOMEM for none.
+		 */
+		if (!vq->num_buffers)
+			count = max_t(unsigned int, count,
+				      vq->min_buffers_needed);
+		*nbuffers = count;
+	}
 
 	return 0;
 }
@@ -112,38 +287,96 @@ static int sun6i_video_buffer_prepare(struct vb2_buffer *vb)
 	struct sun6i_csi_buffer *buf =
 			container_of(vbuf, struct sun6i_csi_buffer, vb);
 	struct sun6i_video *video = vb2_get_drv_priv(vb->vb2_queue);
-	unsigned long size = video->fmt.fmt.pix.sizeimage;
+	struct v4l2_pix_format_mplane *pixfmt = &video->fmt;
+	unsigned long size;
+	dma_addr_t addr;
+	unsigned int i;
 
-	if (vb2_plane_size(vb, 0) < size) {
-		v4l2_err(video->vdev.v4l2_dev, "buffer too small (%lu < %lu)\n",
-			 vb2_plane_size(vb, 0), size);
-		return -EINVAL;
+	for (i = 0; i < pixfmt->num_planes; i++) {
+		size = pixfmt->plane_fmt[i].sizeimage;
+
+		if (vb2_plane_size(vb, i) < size) {
+			v4l2_err(video->vdev.v4l2_dev,
+				 "plane %u too small (%lu < %lu)\n",
+				 i, vb2_plane_size(vb, i), size);
+			return -EINVAL;
+		}
+
+		/*
+		 * vb2-dma-contig refuses USERPTR and DMABUF memory that is not
+		 * contiguous in DMA space, but an imported buffer may still
+		 * start at an address the CSI cannot be programmed with.
+		 */
+		addr = vb2_dma_contig_plane_dma_addr(vb, i);
+		if (!IS_ALIGNED(addr, SUN6I_CSI_BUF_ALIGN)) {
+			v4l2_err(video->vdev.v4l2_dev,
+				 "plane %u address %pad not aligned\n",
+				 i, &addr);
+			return -EINVAL;
+		}
+
+		vb2_set_plane_payload(vb, i, size);
+
+		buf->dma_addr[i] = addr;
 	}
 
-	vb2_set_plane_payload(vb, 0, size);
-
-	buf->dma_addr = vb2_dma_contig_plane_dma_addr(vb, 0);
-
-	vbuf->field = video->fmt.fmt.pix.field;
+	vbuf->field = pixfmt->field;
 
 	return 0;
 }
 
+static int sun6i_video_tpg_start(struct sun6i_video *video);
+static void sun6i_video_tpg_stop(struct sun6i_video *video);
+
 static int sun6i_video_start_streaming(struct vb2_queue *vq, unsigned int count)
 {
 	struct sun6i_video *video = vb2_get_drv_priv(vq);
-	struct sun6i_csi_buffer *buf;
-	struct sun6i_csi_buffer *next_buf;
 	struct sun6i_csi_config config;
 	struct v4l2_subdev *subdev;
-	unsigned long flags;
 	int ret;
 
 	video->sequence = 0;
+	video->skipped = 0;
+	video->sof_ts = 0;
+	video->capture_time = 0;
+	video->recovering = false;
+	video->frame_corrupt = false;
+	video->stream_ts = ktime_get_ns();
+	WRITE_ONCE(video->csi->stats.fifo_max, 0);
+
+	video->tpg = v4l2_ctrl_g_ctrl(video->tpg_ctrl);
+	v4l2_ctrl_grab(video->tpg_ctrl, true);
+	if (video->tpg) {
+		if (v4l2_ctrl_g_ctrl(video->decimation_ctrl) > 1 ||
+		    v4l2_ctrl_g_ctrl(video->recycle_ctrl) ||
+		    !v4l2_format_info(video->fmt.pixelformat)) {
+			ret = -EINVAL;
+			goto release_tpg;
+		}
+
+		ret = sun6i_video_tpg_start(video);
+		if (ret)
+			goto release_tpg;
+		v4l2_ctrl_grab(video->decimation_ctrl, true);
+		v4l2_ctrl_grab(video->recycle_ctrl, true);
+		return 0;
+	}
+
+	ret = sun6i_csi_set_power(video->csi, true);
+	if (ret < 0)
+		goto release_tpg;
+
+	video->recycle = v4l2_ctrl_g_ctrl(video->recycle_ctrl);
+	if (video->recycle) {
+		ret = sun6i_video_scratch_alloc(video);
+		if (ret)
+			goto power_off;
+	}
+	v4l2_ctrl_grab(video->recycle_ctrl, true);
 
 	ret = media_pipeline_start(&video->vdev.entity, &video->vdev.pipe);
 	if (ret < 0)
-		goto clear_dma_queue;
+		goto release_scratch;
 
 	if (video->mbus_code == 0) {
 		ret = -EINVAL;
@@ -151,26 +384,30 @@ static int sun6i_video_start_streaming(struct vb2_queue *vq, unsigned int count)
 	}
 
 	subdev = sun6i_video_remote_subdev(video, NULL);
-	if (!subdev)
+	if (!subdev) {
+		ret = -ENXIO;
 		goto stop_media_pipeline;
+	}
 
-	config.pixelformat = video->fmt.fmt.pix.pixelformat;
+	config.pixelformat = sun6i_video_csi_pixformat(video->fmt.pixelformat);
 	config.code = video->mbus_code;
-	config.field = video->fmt.fmt.pix.field;
-	config.width = video->fmt.fmt.pix.width;
-	config.height = video->fmt.fmt.pix.height;
+	config.field = video->fmt.field;
+	config.width = video->fmt.width;
+	config.height = video->fmt.height;
+	config.bytesperline = video->fmt.plane_fmt[0].bytesperline;
+	config.window = video->window;
+	config.quarter = video->quarter;
 
 	ret = sun6i_csi_update_config(video->csi, &config);
 	if (ret < 0)
 		goto stop_media_pipeline;
 
-	spin_lock_irqsave(&video->dma_queue_lock, flags);
+	/* update_config rewrote CSI_IF_CFG, apply the current decimation */
+	video->frame_decimation = READ_ONCE(video->decimation);
+	sun6i_csi_set_fps_ds(video->csi, video->frame_decimation > 1);
 
-	buf = list_first_entry(&video->dma_queue,
-			       struct sun6i_csi_buffer, list);
-	buf->queued_to_csi = true;
-    
-	sun6i_csi_update_buf_addr(video->csi, buf->dma_addr);
+	/* min_buffers_needed guarantees at least two buffers in the ring. */
+	sun6i_video_ring_arm(video);
 
 	sun6i_csi_set_stream(video->csi, true);
 
@@ -190,29 +427,32 @@ static int sun6i_video_start_streaming(struct vb2_queue *vq, unsigned int count)
 	 * will be stored in first buffer, second frame in second buffer.
 	 * This method is used to avoid dropping the first frame, it
 	 * would also drop frame when lacking of queued buffer.
+	 *
+	 * No frame done IRQ can arrive before the first frame has been
+	 * captured, so the ISR does not race with us on ring_armed here.
 	 */
-	next_buf = list_next_entry(buf, list);
-	next_buf->queued_to_csi = true;
-	sun6i_csi_update_buf_addr(video->csi, next_buf->dma_addr);
-
-	spin_unlock_irqrestore(&video->dma_queue_lock, flags);
+	sun6i_video_ring_arm(video);
 
 	ret = v4l2_subdev_call(subdev, video, s_stream, 1);
 	if (ret && ret != -ENOIOCTLCMD)
 		goto stop_csi_stream;
 
+	sun6i_csi_calibrate(video->csi);
+
 	return 0;
 
 stop_csi_stream:
 	sun6i_csi_set_stream(video->csi, false);
 stop_media_pipeline:
 	media_pipeline_stop(&video->vdev.entity);
-clear_dma_queue:
-	spin_lock_irqsave(&video->dma_queue_lock, flags);
-	list_for_each_entry(buf, &video->dma_queue, list)
-		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_QUEUED);
-	INIT_LIST_HEAD(&video->dma_queue);
-	spin_unlock_irqrestore(&video->dma_queue_lock, flags);
+release_scratch:
+	v4l2_ctrl_grab(video->recycle_ctrl, false);
+	sun6i_video_scratch_free(video);
+power_off:
+	sun6i_csi_set_power(video->csi, false);
+release_tpg:
+	v4l2_ctrl_grab(video->tpg_ctrl, false);
+	sun6i_video_ring_flush(video, VB2_BUF_STATE_QUEUED);
 
 	return ret;
 }
@@ -221,23 +461,33 @@ static void sun6i_video_stop_streaming(struct vb2_queue *vq)
 {
 	struct sun6i_video *video = vb2_get_drv_priv(vq);
 	struct v4l2_subdev *subdev;
-	unsigned long flags;
-	struct sun6i_csi_buffer *buf;
+
+	if (video->tpg) {
+		sun6i_video_tpg_stop(video);
+		sun6i_video_ring_flush(video, VB2_BUF_STATE_ERROR);
+		v4l2_ctrl_grab(video->recycle_ctrl, false);
+		v4l2_ctrl_grab(video->decimation_ctrl, false);
+		v4l2_ctrl_grab(video->tpg_ctrl, false);
+		return;
+	}
 
 	subdev = sun6i_video_remote_subdev(video, NULL);
 	if (subdev)
 		v4l2_subdev_call(subdev, video, s_stream, 0);
 
 	sun6i_csi_set_stream(video->csi, false);
+	hrtimer_cancel(&video->slice_timer);
 
 	media_pipeline_stop(&video->vdev.entity);
 
+	v4l2_ctrl_grab(video->recycle_ctrl, false);
+	sun6i_video_scratch_free(video);
+
 	/* Release all active buffers */
-	spin_lock_irqsave(&video->dma_queue_lock, flags);
-	list_for_each_entry(buf, &video->dma_queue, list)
-		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
-	INIT_LIST_HEAD(&video->dma_queue);
-	spin_unlock_irqrestore(&video->dma_queue_lock, flags);
+	sun6i_video_ring_flush(video, VB2_BUF_STATE_ERROR);
+
+	sun6i_csi_set_power(video->csi, false);
+	v4l2_ctrl_grab(video->tpg_ctrl, false);
 }
 
 static void sun6i_video_buffer_queue(struct vb2_buffer *vb)
@@ -246,60 +496,527 @@ static void sun6i_video_buffer_queue(struct vb2_buffer *vb)
 	struct sun6i_csi_buffer *buf =
 			container_of(vbuf, struct sun6i_csi_buffer, vb);
 	struct sun6i_video *video = vb2_get_drv_priv(vb->vb2_queue);
-	unsigned long flags;
+	unsigned int head = video->ring_head;
+
+	/* vb2 never owns more than VB2_MAX_FRAME buffers, see ring size. */
+	if (WARN_ON(head - smp_load_acquire(&video->ring_done) >=
+		    SUN6I_VIDEO_RING_SIZE)) {
+		vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
+		return;
+	}
+
+	video->ring[head & (SUN6I_VIDEO_RING_SIZE - 1)] = buf;
+
+	/* Publish the slot to the frame done ISR. */
+	smp_store_release(&video->ring_head, head + 1);
 
-	spin_lock_irqsave(&video->dma_queue_lock, flags);
-	buf->queued_to_csi = false;
-	list_add_tail(&buf->list, &video->dma_queue);
-	spin_unlock_irqrestore(&video->dma_queue_lock, flags);
+	trace_sun6i_csi_buffer_queue(video->csi->dev, vb->index,
+				     head + 1 - READ_ONCE(video->ring_tail));
 }
 
-void sun6i_video_frame_done(struct sun6i_video *video)
+static void sun6i_video_buffer_done(struct sun6i_video *video,
+				    unsigned int tail,
+				    enum vb2_buffer_state state)
+{
+	struct sun6i_csi_stats *stats = &video->csi->stats;
+	struct sun6i_csi_buffer *buf = sun6i_video_ring_slot(video, tail);
+	struct vb2_v4l2_buffer *vbuf = &buf->vb;
+
+	vbuf->vb2_buf.timestamp = video->sof_ts;
+	vbuf->sequence = video->sequence;
+	buf->state = state;
+
+	/* Consumed, a next frame without VS falls back to its frame done */
+	video->sof_ts = 0;
+
+	if (state == VB2_BUF_STATE_DONE) {
+		u64_stats_update_begin(&stats->syncp);
+		stats->frames++;
+		u64_stats_update_end(&stats->syncp);
+	}
+
+	/* Hand the buffer over to the IRQ thread. */
+	smp_store_release(&video->ring_tail, tail + 1);
+}
+
+/* Return the retired buffers before @tail to vb2. */
+static void sun6i_video_complete_until(struct sun6i_video *video,
+				       unsigned int tail)
 {
 	struct sun6i_csi_buffer *buf;
-	struct sun6i_csi_buffer *next_buf;
 	struct vb2_v4l2_buffer *vbuf;
 
-	spin_lock(&video->dma_queue_lock);
+	while (video->ring_done != tail) {
+		buf = sun6i_video_ring_slot(video, video->ring_done);
+		vbuf = &buf->vb;
 
-	buf = list_first_entry(&video->dma_queue,
-			       struct sun6i_csi_buffer, list);
-	if (list_is_last(&buf->list, &video->dma_queue)) {
+		trace_sun6i_csi_frame_done(video->csi->dev,
+					   vbuf->vb2_buf.index, vbuf->sequence,
+					   vbuf->vb2_buf.timestamp);
+
+		/* The slot may be reused by buffer_queue from here on. */
+		smp_store_release(&video->ring_done, video->ring_done + 1);
+
+		vb2_buffer_done(&vbuf->vb2_buf, buf->state);
+	}
+}
+
+/*
+ * Threaded half of the interrupt: return the buffers retired by the hard
+ * IRQ handler to vb2, away from the interrupts-off section.
+ */
+void sun6i_video_complete(struct sun6i_video *video)
+{
+	sun6i_video_complete_until(video, smp_load_acquire(&video->ring_tail));
+}
+
+bool sun6i_video_complete_pending(struct sun6i_video *video)
+{
+	return READ_ONCE(video->ring_done) != video->ring_tail;
+}
+
+static void sun6i_video_frame_drop(struct sun6i_video *video,
+				   unsigned int head)
+{
+	struct sun6i_csi_stats *stats = &video->csi->stats;
+
+	trace_sun6i_csi_frame_drop(video->csi->dev, video->sequence,
+				   head - video->ring_tail);
+	/* Nor may the SOF of a dropped frame date the next one */
+	video->sof_ts = 0;
+	u64_stats_update_begin(&stats->syncp);
+	stats->drops++;
+	u64_stats_update_end(&stats->syncp);
+	video->skipped++;
+}
+
+static enum hrtimer_restart sun6i_video_slice_timer(struct hrtimer *timer)
+{
+	struct sun6i_video *video = container_of(timer, struct sun6i_video,
+						 slice_timer);
+	struct v4l2_event event = {
+		.type = V4L2_EVENT_SUN6I_SLICE,
+	};
+	struct sun6i_video_slice_event *slice = (void *)event.u.data;
+	u32 lines = READ_ONCE(video->slice_lines);
+
+	slice->sequence = video->sequence;
+	slice->lines = video->slice_next;
+	v4l2_event_queue(&video->vdev, &event);
+
+	/* The last slice is reported by the frame done itself. */
+	video->slice_next += lines;
+	if (!lines || video->slice_next >= video->fmt.height)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ns_to_ktime(video->slice_line_ns * lines));
+
+	return HRTIMER_RESTART;
+}
+
+static void sun6i_video_slice_start(struct sun6i_video *video)
+{
+	u32 lines = READ_ONCE(video->slice_lines);
+
+	/*
+	 * No line period estimate before the first frame completed. With
+	 * decimation, vsync also fires for the frames that are skipped.
+	 */
+	if (!lines || lines >= video->fmt.height || !video->capture_time ||
+	    video->frame_decimation > 1)
+		return;
+
+	video->slice_line_ns = div_u64((u64)video->capture_time *
+				       NSEC_PER_USEC, video->fmt.height);
+	video->slice_next = lines;
+
+	/* Err on the late side, the DMA may lag behind the line count. */
+	hrtimer_start(&video->slice_timer,
+		      ns_to_ktime(video->slice_line_ns *
+				  (lines + SUN6I_VIDEO_SLICE_MARGIN)),
+		      HRTIMER_MODE_REL);
+}
+
+void sun6i_video_frame_start(struct sun6i_video *video)
+{
+	video->sof_ts = ktime_get_ns();
+	/* A new factor applies from a frame boundary, never mid-frame */
+	video->frame_decimation = READ_ONCE(video->decimation);
+	sun6i_video_slice_start(video);
+
+	/* Capture restarted cleanly after a FIFO overflow. */
+	if (video->recovering) {
+		video->recovering = false;
+		sun6i_csi_stats_inc(video->csi->stats.recoveries);
+	}
+}
+
+/* Account the SOF to frame done time of the frame that just finished. */
+static void sun6i_video_frame_end(struct sun6i_video *video)
+{
+	u64 now = ktime_get_ns();
+
+	/* No VS seen for this frame, fall back to the frame done time. */
+	if (!video->sof_ts)
+		video->sof_ts = now;
+
+	WRITE_ONCE(video->capture_time,
+		   div_u64(now - video->sof_ts, NSEC_PER_USEC));
+
+	if (video->stream_ts) {
+		WRITE_ONCE(video->csi->stats.start_latency,
+			   div_u64(now - video->stream_ts, NSEC_PER_USEC));
+		video->stream_ts = 0;
+	}
+}
+
+/*
+ * State to return the buffer of the frame that just finished in. With
+ * the CRC drop policy a corrupted frame is returned as errored instead
+ * of being handed to userspace as good.
+ */
+static enum vb2_buffer_state sun6i_video_frame_state(struct sun6i_video *video)
+{
+	if (!video->frame_corrupt)
+		return VB2_BUF_STATE_DONE;
+
+	video->frame_corrupt = false;
+	sun6i_csi_stats_inc(video->csi->stats.crc_drops);
+
+	return VB2_BUF_STATE_ERROR;
+}
+
+/*
+ * Program the destination of the frame after the current one. Falls back
+ * to the scratch buffer in recycle mode, returns true if it did so.
+ */
+static bool sun6i_video_arm_next(struct sun6i_video *video, unsigned int head)
+{
+	if (video->ring_armed != head) {
+		sun6i_video_ring_arm(video);
+		return false;
+	}
+
+	if (!video->recycle)
+		return false;
+
+	sun6i_csi_update_buf_addr(video->csi, &video->scratch_dma, 1);
+	return true;
+}
+
+/*
+ * In recycle mode CSI always has a destination for the next frame. The
+ * scratch buffer is programmed whenever the ring runs dry, and frames
+ * stored into it are counted as skipped rather than overwriting a
+ * buffer userspace is waiting for.
+ */
+static void sun6i_video_frame_done_recycle(struct sun6i_video *video)
+{
+	unsigned int head = smp_load_acquire(&video->ring_head);
+
+	sun6i_video_frame_end(video);
+
+	if (video->scratch_cur)
+		sun6i_video_frame_drop(video, head);
+	else
+		sun6i_video_buffer_done(video, video->ring_tail,
+					sun6i_video_frame_state(video));
+	video->frame_corrupt = false;
+
+	/* CSI has already latched the next address for the new frame. */
+	video->scratch_cur = video->scratch_next;
+	video->scratch_next = sun6i_video_arm_next(video, head);
+
+	video->sequence += video->frame_decimation;
+}
+
+void sun6i_video_frame_done(struct sun6i_video *video)
+{
+	unsigned int head;
+	unsigned int tail;
+
+	hrtimer_try_to_cancel(&video->slice_timer);
+
+	/* Stale frame done from before the restart, the frame was errored. */
+	if (video->recovering) {
+		video->frame_corrupt = false;
+		return;
+	}
+
+	if (video->recycle) {
+		sun6i_video_frame_done_recycle(video);
+		return;
+	}
+
+	sun6i_video_frame_end(video);
+
+	head = smp_load_acquire(&video->ring_head);
+	tail = video->ring_tail;
+
+	if (head - tail < 2) {
 		dev_dbg(video->csi->dev, "Frame dropped!\n");
-		goto unlock;
+		sun6i_video_frame_drop(video, head);
+		goto out;
 	}
 
-	next_buf = list_next_entry(buf, list);
-	/* If a new buffer (#next_buf) had not been queued to CSI, the old
-	 * buffer (#buf) is still holding by CSI for storing the next
-	 * frame. So, we queue a new buffer (#next_buf) to CSI then wait
-	 * for next ISR call.
+	/* If a new buffer had not been handed to CSI, the old buffer
+	 * (#tail) is still holding by CSI for storing the next frame.
+	 * So, we hand the next buffer to CSI then wait for next ISR call.
 	 */
-	if (!next_buf->queued_to_csi) {
-		next_buf->queued_to_csi = true;
-		sun6i_csi_update_buf_addr(video->csi, next_buf->dma_addr);
+	if (video->ring_armed == tail + 1) {
+		sun6i_video_ring_arm(video);
 		dev_dbg(video->csi->dev, "Frame dropped!\n");
-		goto unlock;
+		sun6i_video_frame_drop(video, head);
+		goto out;
 	}
 
-	list_del(&buf->list);
-	vbuf = &buf->vb;
-	vbuf->vb2_buf.timestamp = ktime_get_ns();
-	vbuf->sequence = video->sequence;
-	vb2_buffer_done(&vbuf->vb2_buf, VB2_BUF_STATE_DONE);
+	sun6i_video_buffer_done(video, tail, sun6i_video_frame_state(video));
 
 	/* Prepare buffer for next frame but one.  */
-	if (!list_is_last(&next_buf->list, &video->dma_queue)) {
-		next_buf = list_next_entry(next_buf, list);
-		next_buf->queued_to_csi = true;
-		sun6i_csi_update_buf_addr(video->csi, next_buf->dma_addr);
-	} else {
+	if (video->ring_armed != head)
+		sun6i_video_ring_arm(video);
+	else
 		dev_dbg(video->csi->dev, "Next frame will be dropped!\n");
+
+out:
+	video->frame_corrupt = false;
+	/* Frames skipped by the down sampler leave a gap in the sequence */
+	video->sequence += video->frame_decimation;
+}
+
+/* Called before frame done when the frame failed its CRC. */
+void sun6i_video_frame_corrupt(struct sun6i_video *video)
+{
+	if (READ_ONCE(video->crc_drop))
+		video->frame_corrupt = true;
+}
+
+/*
+ * Called from the ISR with capture stopped after a FIFO overflow. The
+ * frame in flight is corrupted: return its buffer as errored if CSI can
+ * do without it, then program the ring from scratch the same way
+ * start_streaming does and restart capture on the next vsync.
+ */
+void sun6i_video_recover(struct sun6i_video *video)
+{
+	unsigned int head = smp_load_acquire(&video->ring_head);
+
+	hrtimer_try_to_cancel(&video->slice_timer);
+
+	if (!video->scratch_cur &&
+	    (head - video->ring_tail >= 2 || video->recycle))
+		sun6i_video_buffer_done(video, video->ring_tail,
+					VB2_BUF_STATE_ERROR);
+	else
+		sun6i_video_frame_drop(video, head);
+
+	video->sequence++;
+
+	video->ring_armed = video->ring_tail;
+	video->scratch_cur = sun6i_video_arm_next(video, head);
+	sun6i_csi_set_capture(video->csi, true);
+	video->scratch_next = sun6i_video_arm_next(video, head);
+
+	video->recovering = true;
+}
+
+/* -----------------------------------------------------------------------------
+ * Software test pattern generator
+ */
+
+/* 75% colour bars, as Y, U, V */
+static const u8 sun6i_video_tpg_bars[8][3] = {
+	{ 180, 128, 128 },	/* white */
+	{ 162,  44, 142 },	/* yellow */
+	{ 131, 156,  44 },	/* cyan */
+	{ 112,  72,  58 },	/* green */
+	{  84, 184, 198 },	/* magenta */
+	{  65, 100, 212 },	/* red */
+	{  35, 212, 114 },	/* blue */
+	{  16, 128, 128 },	/* black */
+};
+
+/*
+ * Draw the pattern into @frame, laid out like a single buffer of the
+ * current format. YUV formats get colour bars, anything else a
+ * horizontal ramp of bytes.
+ */
+static void sun6i_video_tpg_draw(struct sun6i_video *video, u8 *frame)
+{
+	u32 pixformat = sun6i_video_csi_pixformat(video->fmt.pixelformat);
+	const struct v4l2_format_info *info = v4l2_format_info(pixformat);
+	u32 stride = video->fmt.plane_fmt[0].bytesperline;
+	u32 width = video->fmt.width;
+	u32 height = video->fmt.height;
+	const char *order = NULL;
+	unsigned int swap = 0;
+	unsigned int plane;
+	unsigned int x, y;
+	const u8 *bar;
+
+	if (!info || info->pixel_enc != V4L2_PIXEL_ENC_YUV) {
+		for (y = 0; y < height; y++)
+			for (x = 0; x < stride; x++)
+				frame[y * stride + x] = x * 256 / stride;
+		return;
+	}
+
+	switch (pixformat) {
+	case V4L2_PIX_FMT_YUYV:
+		order = "YUYV";
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		order = "YVYU";
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		order = "UYVY";
+		break;
+	case V4L2_PIX_FMT_VYUY:
+		order = "VYUY";
+		break;
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV61:
+	case V4L2_PIX_FMT_YVU420:
+		swap = 1;
+		break;
+	default:
+		break;
+	}
+
+	if (order) {
+		for (y = 0; y < height; y++) {
+			u8 *line = frame + y * stride;
+
+			for (x = 0; x < width * 2; x++) {
+				bar = sun6i_video_tpg_bars[x * 4 / width];
+				switch (order[x & 3]) {
+				case 'Y':
+					line[x] = bar[0];
+					break;
+				case 'U':
+					line[x] = bar[1];
+					break;
+				default:
+					line[x] = bar[2];
+					break;
+				}
+			}
+		}
+		return;
+	}
+
+	for (plane = 0; plane < info->comp_planes; plane++) {
+		unsigned int hdiv = plane ? info->hdiv : 1;
+		unsigned int vdiv = plane ? info->vdiv : 1;
+		u32 pstride = stride;
+
+		/* Same chroma strides as sun6i_video_apply_stride() */
+		if (plane)
+			pstride = DIV_ROUND_UP(stride * info->bpp[plane],
+					       info->bpp[0] * info->hdiv);
+
+		for (y = 0; y < DIV_ROUND_UP(height, vdiv); y++) {
+			u8 *line = frame + y * pstride;
+
+			for (x = 0; x < DIV_ROUND_UP(width, hdiv); x++) {
+				bar = sun6i_video_tpg_bars[x * hdiv * 8 / width];
+				if (!plane) {
+					line[x] = bar[0];
+				} else if (info->comp_planes == 2) {
+					line[2 * x] = bar[1 + swap];
+					line[2 * x + 1] = bar[2 - swap];
+				} else {
+					line[x] = bar[plane == 1 ? 1 + swap :
+								   2 - swap];
+				}
+			}
+		}
+
+		frame += pstride * DIV_ROUND_UP(height, vdiv);
+	}
+}
+
+/* Runs in process context, the buffers may need a kernel mapping first. */
+static void sun6i_video_tpg_work(struct work_struct *work)
+{
+	struct sun6i_video *video = container_of(work, struct sun6i_video,
+						 tpg_work);
+	unsigned int tail = smp_load_acquire(&video->ring_tail);
+	struct sun6i_csi_buffer *buf;
+	unsigned int index;
+	unsigned int i;
+	u8 *src;
+	void *dst;
+
+	for (index = video->ring_done; index != tail; index++) {
+		buf = sun6i_video_ring_slot(video, index);
+		src = video->tpg_frame;
+
+		for (i = 0; i < video->fmt.num_planes; i++) {
+			dst = vb2_plane_vaddr(&buf->vb.vb2_buf, i);
+			if (dst)
+				memcpy(dst, src,
+				       video->fmt.plane_fmt[i].sizeimage);
+			src += video->fmt.plane_fmt[i].sizeimage;
+		}
+	}
+
+	/* Buffers retired since are left to the next run */
+	sun6i_video_complete_until(video, tail);
+}
+
+static ktime_t sun6i_video_tpg_period(struct sun6i_video *video)
+{
+	return ns_to_ktime(div_u64(NSEC_PER_SEC, READ_ONCE(video->tpg_rate)));
+}
+
+/* Stands in for the VS and frame done interrupts, with nothing to wait for */
+static enum hrtimer_restart sun6i_video_tpg_timer(struct hrtimer *timer)
+{
+	struct sun6i_video *video = container_of(timer, struct sun6i_video,
+						 tpg_timer);
+	unsigned int head = smp_load_acquire(&video->ring_head);
+
+	video->sof_ts = ktime_get_ns();
+	sun6i_video_frame_end(video);
+
+	if (head == video->ring_tail) {
+		sun6i_video_frame_drop(video, head);
+	} else {
+		sun6i_video_buffer_done(video, video->ring_tail,
+					VB2_BUF_STATE_DONE);
+		queue_work(system_highpri_wq, &video->tpg_work);
 	}
 
-unlock:
 	video->sequence++;
-	spin_unlock(&video->dma_queue_lock);
+
+	hrtimer_forward_now(timer, sun6i_video_tpg_period(video));
+
+	return HRTIMER_RESTART;
+}
+
+static int sun6i_video_tpg_start(struct sun6i_video *video)
+{
+	video->tpg_frame = vzalloc(sun6i_video_frame_size(video));
+	if (!video->tpg_frame)
+		return -ENOMEM;
+
+	sun6i_video_tpg_draw(video, video->tpg_frame);
+
+	hrtimer_start(&video->tpg_timer, sun6i_video_tpg_period(video),
+		      HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static void sun6i_video_tpg_stop(struct sun6i_video *video)
+{
+	hrtimer_cancel(&video->tpg_timer);
+	/* Let the last run fill and return what the timer retired */
+	flush_work(&video->tpg_work);
+
+	vfree(video->tpg_frame);
+	video->tpg_frame = NULL;
 }
 
 static const struct vb2_ops sun6i_csi_vb2_ops = {
@@ -320,7 +1037,7 @@ static int vidioc_querycap(struct file *file, void *priv,
 	strscpy(cap->driver, "sun6i-video", sizeof(cap->driver));
 	strscpy(cap->card, video->vdev.name, sizeof(cap->card));
 	snprintf(cap->bus_info, sizeof(cap->bus_info), "platform:%s",
-		 video->csi->dev->of_node->name);
+		 dev_name(video->csi->dev));
 
 	return 0;
 }
@@ -328,14 +1045,62 @@ static int vidioc_querycap(struct file *file, void *priv,
 static int vidioc_enum_fmt_vid_cap(struct file *file, void *priv,
 				   struct v4l2_fmtdesc *f)
 {
+	struct sun6i_video *video = video_drvdata(file);
 	u32 index = f->index;
+	unsigned int i;
 
-	if (index >= ARRAY_SIZE(supported_pixformats))
+	f->pixelformat = sun6i_csi_enum_pixformat(index);
+	if (f->pixelformat)
+		return 0;
+
+	if (!video->mplane)
 		return -EINVAL;
 
-	f->pixelformat = supported_pixformats[index];
+	/* Skip over the built in single buffer formats */
+	for (i = 0; sun6i_csi_enum_pixformat(i); i++)
+		;
+	index -= i;
+
+	for (i = 0; i < ARRAY_SIZE(sun6i_video_mplane_formats); i++) {
+		if (!sun6i_csi_find_format(sun6i_video_mplane_formats[i].contig,
+					   0))
+			continue;
+		if (!index--) {
+			f->pixelformat = sun6i_video_mplane_formats[i].mplane;
+			return 0;
+		}
+	}
 
-	return 0;
+	return -EINVAL;
+}
+
+static void sun6i_video_pix_to_mp(const struct v4l2_pix_format *pix,
+				  struct v4l2_pix_format_mplane *pix_mp)
+{
+	memset(pix_mp, 0, sizeof(*pix_mp));
+	pix_mp->width = pix->width;
+	pix_mp->height = pix->height;
+	pix_mp->pixelformat = pix->pixelformat;
+	pix_mp->field = pix->field;
+	pix_mp->num_planes = 1;
+	pix_mp->plane_fmt[0].bytesperline = pix->bytesperline;
+	pix_mp->plane_fmt[0].sizeimage = pix->sizeimage;
+}
+
+static void sun6i_video_mp_to_pix(const struct v4l2_pix_format_mplane *pix_mp,
+				  struct v4l2_pix_format *pix)
+{
+	memset(pix, 0, sizeof(*pix));
+	pix->width = pix_mp->width;
+	pix->height = pix_mp->height;
+	pix->pixelformat = pix_mp->pixelformat;
+	pix->field = pix_mp->field;
+	pix->bytesperline = pix_mp->plane_fmt[0].bytesperline;
+	pix->sizeimage = pix_mp->plane_fmt[0].sizeimage;
+	pix->colorspace = pix_mp->colorspace;
+	pix->ycbcr_enc = pix_mp->ycbcr_enc;
+	pix->quantization = pix_mp->quantization;
+	pix->xfer_func = pix_mp->xfer_func;
 }
 
 static int vidioc_g_fmt_vid_cap(struct file *file, void *priv,
@@ -343,7 +1108,23 @@ static int vidioc_g_fmt_vid_cap(struct file *file, void *priv,
 {
 	struct sun6i_video *video = video_drvdata(file);
 
-	*fmt = video->fmt;
+	if (video->mplane)
+		return -EINVAL;
+
+	sun6i_video_mp_to_pix(&video->fmt, &fmt->fmt.pix);
+
+	return 0;
+}
+
+static int vidioc_g_fmt_vid_cap_mplane(struct file *file, void *priv,
+				       struct v4l2_format *fmt)
+{
+	struct sun6i_video *video = video_drvdata(file);
+
+	if (!video->mplane)
+		return -EINVAL;
+
+	fmt->fmt.pix_mp = video->fmt;
 
 	return 0;
 }
@@ -398,14 +1179,62 @@ static  u32 get_colorspace(u32 fmt)
     return V4L2_COLORSPACE_RAW;
 }
 
+/*
+ * Widen the line stride of a YUV format to @stride bytes, as asked by
+ * userspace, scaling the chroma strides and plane sizes along with it.
+ */
+static void sun6i_video_apply_stride(struct v4l2_pix_format_mplane *pixfmt,
+				     u32 stride)
+{
+	u32 pixformat = sun6i_video_csi_pixformat(pixfmt->pixelformat);
+	const struct sun6i_csi_format *fmt;
+	const struct v4l2_format_info *info;
+	u32 bytesperline;
+	u32 height;
+	unsigned int i;
+
+	/* Same test as sun6i_csi_set_window(), which programs the stride */
+	fmt = sun6i_csi_find_format(pixformat, 0);
+	info = v4l2_format_info(pixfmt->pixelformat);
+	if (!fmt || !fmt->yuv || !info)
+		return;
+
+	stride = min_t(u32, ALIGN(stride, SUN6I_CSI_BUF_ALIGN),
+		       SUN6I_CSI_MAX_STRIDE);
+	if (stride <= pixfmt->plane_fmt[0].bytesperline)
+		return;
+
+	pixfmt->plane_fmt[0].sizeimage = 0;
+	for (i = 0; i < info->comp_planes; i++) {
+		unsigned int plane = info->mem_planes == 1 ? 0 : i;
+
+		if (i == 0) {
+			bytesperline = stride;
+			height = pixfmt->height;
+		} else {
+			bytesperline = DIV_ROUND_UP(stride * info->bpp[i],
+						    info->bpp[0] * info->hdiv);
+			height = DIV_ROUND_UP(pixfmt->height, info->vdiv);
+		}
+
+		if (plane == i) {
+			pixfmt->plane_fmt[i].bytesperline = bytesperline;
+			pixfmt->plane_fmt[i].sizeimage = 0;
+		}
+		pixfmt->plane_fmt[plane].sizeimage += bytesperline * height;
+	}
+}
+
 static int sun6i_video_try_fmt(struct sun6i_video *video,
-			       struct v4l2_format *f)
+			       struct v4l2_pix_format_mplane *pixfmt)
 {
-	struct v4l2_pix_format *pixfmt = &f->fmt.pix;
-	int bpp;
+	struct v4l2_plane_pix_format *plane = &pixfmt->plane_fmt[0];
+	u32 stride = plane->bytesperline;
+	const struct sun6i_csi_format *fmt;
+	int ret;
 
-	if (!is_pixformat_valid(pixfmt->pixelformat))
-		pixfmt->pixelformat = supported_pixformats[0];
+	if (!is_pixformat_valid(video, pixfmt->pixelformat))
+		pixfmt->pixelformat = sun6i_csi_enum_pixformat(0);
 
 	v4l_bound_align_image(&pixfmt->width, MIN_WIDTH, MAX_WIDTH, 1,
 			      &pixfmt->height, MIN_HEIGHT, MAX_HEIGHT, 1, 1);
@@ -414,13 +1243,33 @@ static int sun6i_video_try_fmt(struct sun6i_video *video,
 	//pixfmt->bytesperline = (pixfmt->width * bpp) >> 3;
 	//pixfmt->sizeimage = pixfmt->bytesperline * pixfmt->height;
 
-    v4l2_fill_pixfmt(pixfmt, pixfmt->pixelformat,
-				 pixfmt->width, pixfmt->height);
-    
+	ret = v4l2_fill_pixfmt_mp(pixfmt, pixfmt->pixelformat,
+				  pixfmt->width, pixfmt->height);
+	if (ret) {
+		/* Nothing the test pattern generator could draw */
+		if (v4l2_ctrl_g_ctrl(video->tpg_ctrl))
+			return ret;
+
+		/*
+		 * No v4l2_format_info, JPEG among others. Those are all
+		 * single plane, size it from the format descriptor rather
+		 * than leave it to what userspace passed.
+		 */
+		fmt = sun6i_csi_find_format(pixfmt->pixelformat, 0);
+		pixfmt->num_planes = 1;
+		plane->bytesperline = pixfmt->width * fmt->bpp / 8;
+		plane->sizeimage = plane->bytesperline * pixfmt->height;
+		/* Compressed data has no lines to speak of */
+		if (pixfmt->pixelformat == V4L2_PIX_FMT_JPEG)
+			plane->bytesperline = 0;
+	}
+	sun6i_video_apply_stride(pixfmt, stride);
+
 	if (pixfmt->field == V4L2_FIELD_ANY)
 		pixfmt->field = V4L2_FIELD_NONE;
 
-	pixfmt->colorspace = get_colorspace(pixfmt->pixelformat);
+	pixfmt->colorspace =
+		get_colorspace(sun6i_video_csi_pixformat(pixfmt->pixelformat));
 	pixfmt->ycbcr_enc = V4L2_YCBCR_ENC_DEFAULT;
 	pixfmt->quantization = V4L2_QUANTIZATION_DEFAULT;
 	pixfmt->xfer_func = V4L2_XFER_FUNC_DEFAULT;
@@ -428,15 +1277,16 @@ static int sun6i_video_try_fmt(struct sun6i_video *video,
 	return 0;
 }
 
-static int sun6i_video_set_fmt(struct sun6i_video *video, struct v4l2_format *f)
+static int sun6i_video_set_fmt(struct sun6i_video *video,
+			       struct v4l2_pix_format_mplane *pixfmt)
 {
 	int ret;
 
-	ret = sun6i_video_try_fmt(video, f);
+	ret = sun6i_video_try_fmt(video, pixfmt);
 	if (ret)
 		return ret;
 
-	video->fmt = *f;
+	video->fmt = *pixfmt;
 
 	return 0;
 }
@@ -445,19 +1295,158 @@ static int vidioc_s_fmt_vid_cap(struct file *file, void *priv,
 				struct v4l2_format *f)
 {
 	struct sun6i_video *video = video_drvdata(file);
+	struct v4l2_pix_format_mplane pix_mp;
+	int ret;
+
+	if (video->mplane)
+		return -EINVAL;
+
+	if (vb2_is_busy(&video->vb2_vidq))
+		return -EBUSY;
+
+	sun6i_video_pix_to_mp(&f->fmt.pix, &pix_mp);
+	ret = sun6i_video_set_fmt(video, &pix_mp);
+	sun6i_video_mp_to_pix(&pix_mp, &f->fmt.pix);
+
+	return ret;
+}
+
+static int vidioc_s_fmt_vid_cap_mplane(struct file *file, void *priv,
+				       struct v4l2_format *f)
+{
+	struct sun6i_video *video = video_drvdata(file);
+
+	if (!video->mplane)
+		return -EINVAL;
 
 	if (vb2_is_busy(&video->vb2_vidq))
 		return -EBUSY;
 
-	return sun6i_video_set_fmt(video, f);
+	return sun6i_video_set_fmt(video, &f->fmt.pix_mp);
 }
 
 static int vidioc_try_fmt_vid_cap(struct file *file, void *priv,
 				  struct v4l2_format *f)
 {
 	struct sun6i_video *video = video_drvdata(file);
+	struct v4l2_pix_format_mplane pix_mp;
+	int ret;
+
+	if (video->mplane)
+		return -EINVAL;
+
+	sun6i_video_pix_to_mp(&f->fmt.pix, &pix_mp);
+	ret = sun6i_video_try_fmt(video, &pix_mp);
+	sun6i_video_mp_to_pix(&pix_mp, &f->fmt.pix);
+
+	return ret;
+}
+
+static int vidioc_try_fmt_vid_cap_mplane(struct file *file, void *priv,
+					 struct v4l2_format *f)
+{
+	struct sun6i_video *video = video_drvdata(file);
+
+	if (!video->mplane)
+		return -EINVAL;
+
+	return sun6i_video_try_fmt(video, &f->fmt.pix_mp);
+}
+
+/* The crop bounds are the active format of the connected source pad */
+static int sun6i_video_source_frame(struct sun6i_video *video,
+				    struct v4l2_rect *bounds)
+{
+	struct v4l2_subdev_format fmt = {
+		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+	};
+	struct v4l2_subdev *subdev;
+	int ret;
+
+	subdev = sun6i_video_remote_subdev(video, &fmt.pad);
+	if (!subdev)
+		return -ENXIO;
+
+	ret = v4l2_subdev_call(subdev, pad, get_fmt, NULL, &fmt);
+	if (ret)
+		return ret;
+
+	bounds->left = 0;
+	bounds->top = 0;
+	bounds->width = fmt.format.width;
+	bounds->height = fmt.format.height;
+
+	return 0;
+}
+
+static bool sun6i_video_is_sel_type(struct sun6i_video *video, u32 type)
+{
+	/* The mplane buffer type is accepted as well as the plain one */
+	return type == V4L2_BUF_TYPE_VIDEO_CAPTURE ||
+	       type == video->vb2_vidq.type;
+}
+
+static int vidioc_g_selection(struct file *file, void *fh,
+			      struct v4l2_selection *s)
+{
+	struct sun6i_video *video = video_drvdata(file);
+	struct v4l2_rect bounds;
+	int ret;
+
+	if (!sun6i_video_is_sel_type(video, s->type))
+		return -EINVAL;
+
+	ret = sun6i_video_source_frame(video, &bounds);
+	if (ret)
+		return ret;
 
-	return sun6i_video_try_fmt(video, f);
+	switch (s->target) {
+	case V4L2_SEL_TGT_CROP_BOUNDS:
+	case V4L2_SEL_TGT_CROP_DEFAULT:
+		s->r = bounds;
+		return 0;
+	case V4L2_SEL_TGT_CROP:
+		s->r = video->crop.width ? video->crop : bounds;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int vidioc_s_selection(struct file *file, void *fh,
+			      struct v4l2_selection *s)
+{
+	struct sun6i_video *video = video_drvdata(file);
+	struct v4l2_rect bounds;
+	struct v4l2_rect r;
+	int ret;
+
+	if (!sun6i_video_is_sel_type(video, s->type) ||
+	    s->target != V4L2_SEL_TGT_CROP)
+		return -EINVAL;
+
+	if (vb2_is_busy(&video->vb2_vidq))
+		return -EBUSY;
+
+	ret = sun6i_video_source_frame(video, &bounds);
+	if (ret)
+		return ret;
+
+	/* Keep 4:2:x chroma sites aligned */
+	r.width = clamp_t(u32, ALIGN(s->r.width, 2), 2, bounds.width);
+	r.height = clamp_t(u32, ALIGN(s->r.height, 2), 2, bounds.height);
+	r.left = clamp_t(s32, s->r.left, 0, bounds.width - r.width) & ~1;
+	r.top = clamp_t(s32, s->r.top, 0, bounds.height - r.height) & ~1;
+
+	/* A full frame crop follows later source format changes */
+	if (v4l2_rect_equal(&r, &bounds))
+		memset(&video->crop, 0, sizeof(video->crop));
+	else
+		video->crop = r;
+
+	s->r = r;
+
+	return 0;
 }
 
 static int vidioc_enum_input(struct file *file, void *fh,
@@ -487,12 +1476,30 @@ static int vidioc_s_input(struct file *file, void *fh, unsigned int i)
 	return 0;
 }
 
+static int sun6i_video_subscribe_event(struct v4l2_fh *fh,
+				       const struct v4l2_event_subscription *sub)
+{
+	switch (sub->type) {
+	case V4L2_EVENT_SUN6I_SLICE:
+		return v4l2_event_subscribe(fh, sub, SUN6I_VIDEO_SLICE_EVENTS,
+					    NULL);
+	default:
+		return v4l2_ctrl_subscribe_event(fh, sub);
+	}
+}
+
 static const struct v4l2_ioctl_ops sun6i_video_ioctl_ops = {
 	.vidioc_querycap		= vidioc_querycap,
 	.vidioc_enum_fmt_vid_cap	= vidioc_enum_fmt_vid_cap,
 	.vidioc_g_fmt_vid_cap		= vidioc_g_fmt_vid_cap,
 	.vidioc_s_fmt_vid_cap		= vidioc_s_fmt_vid_cap,
 	.vidioc_try_fmt_vid_cap		= vidioc_try_fmt_vid_cap,
+	.vidioc_g_fmt_vid_cap_mplane	= vidioc_g_fmt_vid_cap_mplane,
+	.vidioc_s_fmt_vid_cap_mplane	= vidioc_s_fmt_vid_cap_mplane,
+	.vidioc_try_fmt_vid_cap_mplane	= vidioc_try_fmt_vid_cap_mplane,
+
+	.vidioc_g_selection		= vidioc_g_selection,
+	.vidioc_s_selection		= vidioc_s_selection,
 
 	.vidioc_enum_input		= vidioc_enum_input,
 	.vidioc_s_input			= vidioc_s_input,
@@ -509,7 +1516,7 @@ static const struct v4l2_ioctl_ops sun6i_video_ioctl_ops = {
 	.vidioc_streamoff		= vb2_ioctl_streamoff,
 
 	.vidioc_log_status		= v4l2_ctrl_log_status,
-	.vidioc_subscribe_event		= v4l2_ctrl_subscribe_event,
+	.vidioc_subscribe_event		= sun6i_video_subscribe_event,
 	.vidioc_unsubscribe_event	= v4l2_event_unsubscribe,
 };
 
@@ -528,18 +1535,11 @@ static int sun6i_video_open(struct file *file)
 	if (ret < 0)
 		goto unlock;
 
+	/* The csi itself is only powered while streaming */
 	ret = v4l2_pipeline_pm_get(&video->vdev.entity);
 	if (ret < 0)
 		goto fh_release;
 
-	/* check if already powered */
-	if (!v4l2_fh_is_singular_file(file))
-		goto unlock;
-
-	ret = sun6i_csi_set_power(video->csi, true);
-	if (ret < 0)
-		goto fh_release;
-
 	mutex_unlock(&video->lock);
 	return 0;
 
@@ -553,19 +1553,13 @@ unlock:
 static int sun6i_video_close(struct file *file)
 {
 	struct sun6i_video *video = video_drvdata(file);
-	bool last_fh;
 
 	mutex_lock(&video->lock);
 
-	last_fh = v4l2_fh_is_singular_file(file);
-
 	_vb2_fop_release(file, NULL);
 
 	v4l2_pipeline_pm_put(&video->vdev.entity);
 
-	if (last_fh)
-		sun6i_csi_set_power(video->csi, false);
-
 	mutex_unlock(&video->lock);
 
 	return 0;
@@ -580,6 +1574,317 @@ static const struct v4l2_file_operations sun6i_video_fops = {
 	.poll		= vb2_fop_poll
 };
 
+/* -----------------------------------------------------------------------------
+ * V4L2 controls
+ */
+static int sun6i_video_g_volatile_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct sun6i_csi *csi = container_of(ctrl->handler, struct sun6i_csi,
+					     ctrl_handler);
+	struct sun6i_video *video = &csi->video;
+
+	switch (ctrl->id) {
+	case V4L2_CID_SUN6I_SKIPPED_FRAMES:
+		ctrl->val = READ_ONCE(video->skipped);
+		return 0;
+	case V4L2_CID_SUN6I_CAPTURE_TIME:
+		ctrl->val = READ_ONCE(video->capture_time);
+		return 0;
+	case V4L2_CID_SUN6I_FRAME_PERIOD:
+		ctrl->val = READ_ONCE(csi->stats.frame_period);
+		return 0;
+	case V4L2_CID_SUN6I_PCLK_LINE_MIN:
+		ctrl->val = READ_ONCE(csi->stats.pclk_line_min);
+		return 0;
+	case V4L2_CID_SUN6I_PCLK_LINE_MAX:
+		ctrl->val = READ_ONCE(csi->stats.pclk_line_max);
+		return 0;
+	case V4L2_CID_SUN6I_FIFO_MAX:
+		ctrl->val = READ_ONCE(csi->stats.fifo_max);
+		return 0;
+	case V4L2_CID_SUN6I_LANE_RATE:
+		ctrl->val = READ_ONCE(csi->stats.lane_rate);
+		return 0;
+	case V4L2_CID_SUN6I_MIPI_ECC_ERRORS:
+		ctrl->val = READ_ONCE(csi->stats.mipi_ecc_err);
+		return 0;
+	case V4L2_CID_SUN6I_MIPI_CRC_ERRORS:
+		ctrl->val = READ_ONCE(csi->stats.mipi_crc_err);
+		return 0;
+	case V4L2_CID_SUN6I_MIPI_SYNC_ERRORS:
+		ctrl->val = READ_ONCE(csi->stats.mipi_frame_sync_err) +
+			    READ_ONCE(csi->stats.mipi_line_sync_err) +
+			    READ_ONCE(csi->stats.mipi_eot_err);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int sun6i_video_s_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct sun6i_csi *csi = container_of(ctrl->handler, struct sun6i_csi,
+					     ctrl_handler);
+	struct sun6i_video *video = &csi->video;
+
+	switch (ctrl->id) {
+	case V4L2_CID_SUN6I_RECYCLE_MODE:
+		/* Latched by start_streaming */
+		return 0;
+	case V4L2_CID_SUN6I_SLICE_LINES:
+		/* Picked up at the next vsync */
+		WRITE_ONCE(video->slice_lines, ctrl->val);
+		return 0;
+	case V4L2_CID_SUN6I_FRAME_DECIMATION:
+		/*
+		 * start_streaming applies the value again after writing
+		 * CSI_IF_CFG, so racing with it is harmless. The sequence
+		 * follows from the next vsync on.
+		 */
+		WRITE_ONCE(video->decimation, ctrl->val);
+		sun6i_csi_set_fps_ds(csi, ctrl->val > 1);
+		return 0;
+	case V4L2_CID_TEST_PATTERN:
+		/* Latched by start_streaming */
+		return 0;
+	case V4L2_CID_SUN6I_TPG_RATE:
+		/* Picked up at the next generated frame */
+		WRITE_ONCE(video->tpg_rate, ctrl->val);
+		return 0;
+	case V4L2_CID_SUN6I_CRC_DROP:
+		/* Applies from the next frame done */
+		WRITE_ONCE(video->crc_drop, ctrl->val);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static const struct v4l2_ctrl_ops sun6i_video_ctrl_ops = {
+	.g_volatile_ctrl	= sun6i_video_g_volatile_ctrl,
+	.s_ctrl			= sun6i_video_s_ctrl,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_recycle_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_RECYCLE_MODE,
+	.name	= "Recycle Last Buffer",
+	.type	= V4L2_CTRL_TYPE_BOOLEAN,
+	.min	= 0,
+	.max	= 1,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_skipped_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_SKIPPED_FRAMES,
+	.name	= "Skipped Frames",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_capture_time_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_CAPTURE_TIME,
+	.name	= "Frame Capture Time (us)",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+/* The CSI down sampler only knows how to halve the frame rate */
+static const struct v4l2_ctrl_config sun6i_video_decimation_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_FRAME_DECIMATION,
+	.name	= "Frame Decimation",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.min	= 1,
+	.max	= 2,
+	.step	= 1,
+	.def	= 1,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_slice_lines_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_SLICE_LINES,
+	.name	= "Slice Event Lines",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.min	= 0,
+	.max	= MAX_HEIGHT,
+	.step	= 1,
+	.def	= 0,
+};
+
+/* Sampled from the CSI counters at every frame done */
+static const struct v4l2_ctrl_config sun6i_video_frame_period_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_FRAME_PERIOD,
+	.name	= "Frame Period (us)",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_pclk_line_min_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_PCLK_LINE_MIN,
+	.name	= "Pixel Clocks per Line Min",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_pclk_line_max_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_PCLK_LINE_MAX,
+	.name	= "Pixel Clocks per Line Max",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_fifo_max_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_FIFO_MAX,
+	.name	= "FIFO High-Water Mark",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+/* Chosen at bus setup, corrected once the sensor streams */
+static const struct v4l2_ctrl_config sun6i_video_lane_rate_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_LANE_RATE,
+	.name	= "MIPI Lane Rate (bps)",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+/* Polled from the MIPI receiver at every frame done, never reset */
+static const struct v4l2_ctrl_config sun6i_video_ecc_errors_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_MIPI_ECC_ERRORS,
+	.name	= "MIPI ECC Errors",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_crc_errors_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_MIPI_CRC_ERRORS,
+	.name	= "MIPI CRC Errors",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+/* Frame sync, line sync and end of transmission errors */
+static const struct v4l2_ctrl_config sun6i_video_sync_errors_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_MIPI_SYNC_ERRORS,
+	.name	= "MIPI Sync Errors",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.flags	= V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min	= 0,
+	.max	= S32_MAX,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_crc_drop_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_CRC_DROP,
+	.name	= "Drop Frames on CRC Error",
+	.type	= V4L2_CTRL_TYPE_BOOLEAN,
+	.min	= 0,
+	.max	= 1,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config sun6i_video_tpg_rate_ctrl = {
+	.ops	= &sun6i_video_ctrl_ops,
+	.id	= V4L2_CID_SUN6I_TPG_RATE,
+	.name	= "Test Pattern Frame Rate",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.min	= 1,
+	.max	= SUN6I_VIDEO_TPG_MAX_RATE,
+	.step	= 1,
+	.def	= SUN6I_VIDEO_TPG_DEF_RATE,
+};
+
+static const char * const sun6i_video_tpg_menu[] = {
+	"Disabled",
+	"Color Bars (Software)",
+};
+
+static int sun6i_video_ctrls_init(struct sun6i_video *video)
+{
+	struct v4l2_ctrl_handler *hdl = &video->csi->ctrl_handler;
+
+	video->recycle_ctrl = v4l2_ctrl_new_custom(hdl,
+						   &sun6i_video_recycle_ctrl,
+						   NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_skipped_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_capture_time_ctrl, NULL);
+	video->decimation_ctrl = v4l2_ctrl_new_custom(hdl,
+						&sun6i_video_decimation_ctrl,
+						NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_slice_lines_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_frame_period_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_pclk_line_min_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_pclk_line_max_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_fifo_max_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_lane_rate_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_ecc_errors_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_crc_errors_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_sync_errors_ctrl, NULL);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_crc_drop_ctrl, NULL);
+	v4l2_ctrl_new_std(hdl, NULL, V4L2_CID_MIN_BUFFERS_FOR_CAPTURE,
+			  SUN6I_VIDEO_MIN_BUFFERS, SUN6I_VIDEO_MIN_BUFFERS, 1,
+			  SUN6I_VIDEO_MIN_BUFFERS);
+	video->tpg_ctrl = v4l2_ctrl_new_std_menu_items(hdl,
+					&sun6i_video_ctrl_ops,
+					V4L2_CID_TEST_PATTERN,
+					ARRAY_SIZE(sun6i_video_tpg_menu) - 1,
+					0, 0, sun6i_video_tpg_menu);
+	v4l2_ctrl_new_custom(hdl, &sun6i_video_tpg_rate_ctrl, NULL);
+
+	return hdl->error;
+}
+
 /* -----------------------------------------------------------------------------
  * Media Operations
  */
@@ -604,6 +1909,8 @@ static int sun6i_video_link_validate(struct media_link *link)
 						 struct video_device, entity);
 	struct sun6i_video *video = video_get_drvdata(vdev);
 	struct v4l2_subdev_format source_fmt;
+	struct v4l2_rect window;
+	bool quarter;
 	int ret;
 
 	video->mbus_code = 0;
@@ -619,24 +1926,59 @@ static int sun6i_video_link_validate(struct media_link *link)
 		return ret;
 
 	if (!sun6i_csi_is_format_supported(video->csi,
-					   video->fmt.fmt.pix.pixelformat,
-					   source_fmt.format.code)) {
+			sun6i_video_csi_pixformat(video->fmt.pixelformat),
+			source_fmt.format.code)) {
 		dev_err(video->csi->dev,
 			"Unsupported pixformat: 0x%x with mbus code: 0x%x!\n",
-			video->fmt.fmt.pix.pixelformat,
+			video->fmt.pixelformat,
 			source_fmt.format.code);
 		return -EPIPE;
 	}
 
-	if (source_fmt.format.width != video->fmt.fmt.pix.width ||
-	    source_fmt.format.height != video->fmt.fmt.pix.height) {
+	if (is_media_entity_v4l2_subdev(link->source->entity)) {
+		ret = sun6i_csi_check_bandwidth(video->csi,
+				media_entity_to_v4l2_subdev(link->source->entity),
+				sun6i_video_csi_pixformat(video->fmt.pixelformat),
+				&source_fmt.format);
+		if (ret)
+			return ret;
+	}
+
+	window = video->crop;
+	if (!window.width) {
+		window.left = 0;
+		window.top = 0;
+		window.width = source_fmt.format.width;
+		window.height = source_fmt.format.height;
+	}
+
+	if (window.left + window.width > source_fmt.format.width ||
+	    window.top + window.height > source_fmt.format.height) {
 		dev_err(video->csi->dev,
-			"Wrong width or height %ux%u (%ux%u expected)\n",
-			video->fmt.fmt.pix.width, video->fmt.fmt.pix.height,
+			"Crop %ux%u@%d,%d outside of the %ux%u source frame\n",
+			window.width, window.height, window.left, window.top,
 			source_fmt.format.width, source_fmt.format.height);
 		return -EPIPE;
 	}
 
+	/* The capture is either the window itself or a quarter of it */
+	if (video->fmt.width == window.width &&
+	    video->fmt.height == window.height) {
+		quarter = false;
+	} else if (video->fmt.width * 4 == window.width &&
+		   video->fmt.height * 4 == window.height) {
+		quarter = true;
+	} else {
+		dev_err(video->csi->dev,
+			"Wrong width or height %ux%u (%ux%u or %ux%u expected)\n",
+			video->fmt.width, video->fmt.height,
+			window.width, window.height,
+			window.width / 4, window.height / 4);
+		return -EPIPE;
+	}
+
+	video->window = window;
+	video->quarter = quarter;
 	video->mbus_code = source_fmt.format.code;
 
 	return 0;
@@ -651,10 +1993,11 @@ int sun6i_video_init(struct sun6i_video *video, struct sun6i_csi *csi,
 {
 	struct video_device *vdev = &video->vdev;
 	struct vb2_queue *vidq = &video->vb2_vidq;
-	struct v4l2_format fmt = { 0 };
+	struct v4l2_pix_format_mplane pixfmt = { 0 };
 	int ret;
 
 	video->csi = csi;
+	video->mplane = mplane;
 
 	/* Initialize the media entity... */
 	video->pad.flags = MEDIA_PAD_FL_SINK | MEDIA_PAD_FL_MUST_CONNECT;
@@ -665,30 +2008,51 @@ int sun6i_video_init(struct sun6i_video *video, struct sun6i_csi *csi,
 
 	mutex_init(&video->lock);
 
-	INIT_LIST_HEAD(&video->dma_queue);
-	spin_lock_init(&video->dma_queue_lock);
+	BUILD_BUG_ON(!is_power_of_2(SUN6I_VIDEO_RING_SIZE));
+	video->ring_head = 0;
+	video->ring_tail = 0;
+	video->ring_armed = 0;
+	video->ring_done = 0;
 
 	video->sequence = 0;
+	video->decimation = 1;
+	video->frame_decimation = 1;
+
+	hrtimer_init(&video->slice_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	video->slice_timer.function = sun6i_video_slice_timer;
+
+	video->tpg_rate = SUN6I_VIDEO_TPG_DEF_RATE;
+	hrtimer_init(&video->tpg_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	video->tpg_timer.function = sun6i_video_tpg_timer;
+	INIT_WORK(&video->tpg_work, sun6i_video_tpg_work);
+
+	ret = sun6i_video_ctrls_init(video);
+	if (ret) {
+		v4l2_err(&csi->v4l2_dev, "control init failed: %d\n", ret);
+		goto clean_entity;
+	}
 
 	/* Setup default format */
-	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	fmt.fmt.pix.pixelformat = supported_pixformats[0];
-	fmt.fmt.pix.width = 1280;
-	fmt.fmt.pix.height = 720;
-	fmt.fmt.pix.field = V4L2_FIELD_NONE;
-	sun6i_video_set_fmt(video, &fmt);
+	pixfmt.pixelformat = sun6i_csi_enum_pixformat(0);
+	pixfmt.width = 1280;
+	pixfmt.height = 720;
+	pixfmt.field = V4L2_FIELD_NONE;
+	sun6i_video_set_fmt(video, &pixfmt);
 
 	/* Initialize videobuf2 queue */
-	vidq->type			= V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	vidq->type			= video->mplane ?
+					  V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+					  V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	vidq->io_modes			= VB2_MMAP | VB2_DMABUF | VB2_USERPTR;
 	vidq->drv_priv			= video;
 	vidq->buf_struct_size		= sizeof(struct sun6i_csi_buffer);
 	vidq->ops			= &sun6i_csi_vb2_ops;
 	vidq->mem_ops			= &vb2_dma_contig_memops;
-	vidq->timestamp_flags		= V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	vidq->timestamp_flags		= V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC |
+					  V4L2_BUF_FLAG_TSTAMP_SRC_SOE;
 	vidq->lock			= &video->lock;
 	/* Make sure non-dropped frame */
-	vidq->min_buffers_needed	= 3;
+	vidq->min_buffers_needed	= SUN6I_VIDEO_MIN_BUFFERS;
 	vidq->dev			= csi->dev;
 
 	ret = vb2_queue_init(vidq);
@@ -707,7 +2071,9 @@ int sun6i_video_init(struct sun6i_video *video, struct sun6i_csi *csi,
 	vdev->v4l2_dev		= &csi->v4l2_dev;
 	vdev->queue		= vidq;
 	vdev->lock		= &video->lock;
-	vdev->device_caps	= V4L2_CAP_STREAMING | V4L2_CAP_VIDEO_CAPTURE;
+	vdev->device_caps	= V4L2_CAP_STREAMING |
+				  (video->mplane ? V4L2_CAP_VIDEO_CAPTURE_MPLANE :
+						   V4L2_CAP_VIDEO_CAPTURE);
 	video_set_drvdata(vdev, video);
 
 	ret = video_register_device(vdev, VFL_TYPE_VIDEO, -1);
@@ -734,3 +2100,8 @@ void sun6i_video_cleanup(struct sun6i_video *video)
 	vb2_queue_release(&video->vb2_vidq);
 	mutex_destroy(&video->lock);
 }
+
+#if IS_ENABLED(CONFIG_VIDEO_SUN6I_MIPI_CSI_AO_KUNIT_TEST)
+#include "sun6i_video_test.c"
+#include "sun6i_csi_test.c"
+#endif
@@ -8,10 +8,22 @@
 #ifndef __SUN6I_VIDEO_H__
 #define __SUN6I_VIDEO_H__
 
+#include <linux/hrtimer.h>
+#include <linux/sun6i-csi.h>
+#include <linux/workqueue.h>
+
+#include <media/v4l2-ctrls.h>
 #include <media/v4l2-dev.h>
 #include <media/videobuf2-core.h>
 
 struct sun6i_csi;
+struct sun6i_csi_buffer;
+
+/*
+ * Size of the buffer ring between buffer_queue and the frame done ISR.
+ * Must be a power of two and large enough to hold every vb2 buffer.
+ */
+#define SUN6I_VIDEO_RING_SIZE		VB2_MAX_FRAME
 
 struct sun6i_video {
 	struct video_device		vdev;
@@ -21,18 +33,110 @@ struct sun6i_video {
 	struct mutex			lock;
 
 	struct vb2_queue		vb2_vidq;
-	spinlock_t			dma_queue_lock;
-	struct list_head		dma_queue;
+
+	/*
+	 * Single-producer/single-consumer ring of queued buffers.
+	 * buffer_queue is the only writer of ring_head, the frame done ISR
+	 * the only writer of ring_tail and ring_armed, the IRQ thread the
+	 * only writer of ring_done. Slots in [ring_done, ring_tail) are
+	 * filled and wait for the IRQ thread to return them to vb2, slots in
+	 * [ring_tail, ring_armed) have been handed to the CSI DMA, slots in
+	 * [ring_armed, ring_head) are waiting to be programmed.
+	 */
+	struct sun6i_csi_buffer		*ring[SUN6I_VIDEO_RING_SIZE];
+	unsigned int			ring_head;
+	unsigned int			ring_tail;
+	unsigned int			ring_armed;
+	unsigned int			ring_done;
+
+	/*
+	 * Recycle mode: when userspace runs out of buffers CSI writes into
+	 * a kernel-owned scratch buffer instead of overwriting the last
+	 * queued one. scratch_cur/scratch_next tell whether the frame in
+	 * progress and the programmed next frame go to the scratch buffer.
+	 */
+	struct v4l2_ctrl		*recycle_ctrl;
+	bool				recycle;
+	void				*scratch_cookie;
+	dma_addr_t			scratch_dma;
+	size_t				scratch_size;
+	bool				scratch_cur;
+	bool				scratch_next;
+	u32				skipped;
+
+	/* capture restarted after a FIFO overflow, waiting for vsync */
+	bool				recovering;
+
+	/*
+	 * One frame out of decimation is captured, may change mid-stream.
+	 * frame_decimation is the value latched at the vsync of the frame
+	 * in progress, which its frame done advances the sequence by.
+	 */
+	struct v4l2_ctrl		*decimation_ctrl;
+	u32				decimation;
+	u32				frame_decimation;
+
+	/*
+	 * Return frames the MIPI receiver saw a checksum error in as
+	 * errored. frame_corrupt marks the frame in progress.
+	 */
+	bool				crc_drop;
+	bool				frame_corrupt;
+
+	/* multi-planar API, one memory plane per CSI output plane */
+	bool				mplane;
 
 	unsigned int			sequence;
-	struct v4l2_format		fmt;
+	/* STREAMON time, cleared by the first frame done */
+	u64				stream_ts;
+	/*
+	 * Slice events. CSI has no line counter interrupt, so the line
+	 * period is estimated from the last capture time and the events
+	 * are timed from vsync.
+	 */
+	struct hrtimer			slice_timer;
+	u32				slice_lines;
+	u32				slice_next;
+	u64				slice_line_ns;
+
+	/*
+	 * Software test pattern generator. CSI and the sensor are left
+	 * off, tpg_timer retires a buffer every 1/tpg_rate s the way the
+	 * frame done ISR does and tpg_work copies tpg_frame into it before
+	 * returning it to vb2. Generated frames skip the down sampler and
+	 * the scratch buffer, so decimation and recycle mode are refused
+	 * with it, and so are formats v4l2_format_info() has no layout of.
+	 */
+	struct v4l2_ctrl		*tpg_ctrl;
+	bool				tpg;
+	u32				tpg_rate;
+	struct hrtimer			tpg_timer;
+	struct work_struct		tpg_work;
+	void				*tpg_frame;
+
+	/* start of frame timestamp, taken in the VS interrupt */
+	u64				sof_ts;
+	/* SOF to frame done delta of the last completed frame, in us */
+	u32				capture_time;
+	struct v4l2_pix_format_mplane	fmt;
 	u32				mbus_code;
+
+	/* S_SELECTION crop of the source frame, zero width for no crop */
+	struct v4l2_rect		crop;
+	/* source window and quarter scaling resolved by link_validate */
+	struct v4l2_rect		window;
+	bool				quarter;
 };
 
 int sun6i_video_init(struct sun6i_video *video, struct sun6i_csi *csi,
 		     const char *name);
 void sun6i_video_cleanup(struct sun6i_video *video);
 
+void sun6i_video_frame_start(struct sun6i_video *video);
 void sun6i_video_frame_done(struct sun6i_video *video);
+void sun6i_video_frame_corrupt(struct sun6i_video *video);
+void sun6i_video_recover(struct sun6i_video *video);
+void sun6i_video_complete(struct sun6i_video *video);
+bool sun6i_video_complete_pending(struct sun6i_video *video);
 
 #endif /* __SUN6I_VIDEO_H__ */
@@ -0,0 +1,486 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * KUnit tests of the buffer ring between buffer_queue and the frame done
+ * ISR. Included at the end of sun6i_video.c to reach its static functions.
+ *
+ * The fake CSI the tests drive the driver with is shared with the
+ * interrupt tests in sun6i_csi_test.c. The register block is plain memory
+ * behind the driver's regmap, the vb2 queue only has what
+ * vb2_buffer_done() touches.
+ */
+
+#include <kunit/test.h>
+#include <linux/device.h>
+#include <linux/regmap.h>
+#include <linux/sizes.h>
+
+#include "sun6i_csi_reg.h"
+#include "sun6i_mipi_reg.h"
+
+/* One more than the ring holds, to refill a freed slot */
+#define SUN6I_CSI_TEST_BUFFERS		(SUN6I_VIDEO_RING_SIZE + 1)
+/* Up to the last DPHY register */
+#define SUN6I_CSI_TEST_REGS		(0x20f8 / 4)
+
+/* DMA address of test buffer @i */
+#define SUN6I_CSI_TEST_DMA(i)		((u32)SZ_1M * ((i) + 1))
+
+/**
+ * struct sun6i_csi_test - fake device of a test case, in test->priv
+ * @sdev:	driver state, its regmap is backed by @regs
+ * @dev:	stands in for the platform device
+ * @regs:	register block, the interrupt status registers are write one
+ *		to clear as on the hardware
+ * @vq:		queue the buffers are returned to
+ * @bufs:	SUN6I_CSI_TEST_BUFFERS buffers, see sun6i_csi_test_vb()
+ */
+struct sun6i_csi_test {
+	struct sun6i_csi_dev		sdev;
+	struct device			*dev;
+	u32				regs[SUN6I_CSI_TEST_REGS];
+	struct vb2_queue		vq;
+	struct sun6i_csi_buffer		*bufs;
+};
+
+static int sun6i_csi_test_reg_read(void *context, unsigned int reg,
+				   unsigned int *val)
+{
+	struct sun6i_csi_test *t = context;
+
+	*val = t->regs[reg / 4];
+	return 0;
+}
+
+static int sun6i_csi_test_reg_write(void *context, unsigned int reg,
+				    unsigned int val)
+{
+	struct sun6i_csi_test *t = context;
+
+	switch (reg) {
+	case CSI_CH_INT_STA_REG:
+	case CSI_CH_REG(CSI_CH_INT_STA_REG, SUN6I_META_CSI_CH):
+	case MIPI_CSI2_CH_INT_PD_REG:
+		t->regs[reg / 4] &= ~val;
+		break;
+	default:
+		t->regs[reg / 4] = val;
+		break;
+	}
+
+	return 0;
+}
+
+static const struct regmap_config sun6i_csi_test_regmap_config = {
+	.reg_bits	= 32,
+	.reg_stride	= 4,
+	.val_bits	= 32,
+	.max_register	= (SUN6I_CSI_TEST_REGS - 1) * 4,
+	.reg_read	= sun6i_csi_test_reg_read,
+	.reg_write	= sun6i_csi_test_reg_write,
+};
+
+static int sun6i_csi_test_init(struct kunit *test)
+{
+	struct sun6i_csi_test *t;
+	struct sun6i_video *video;
+	unsigned int i;
+
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t);
+	t->bufs = kunit_kzalloc(test, array_size(SUN6I_CSI_TEST_BUFFERS,
+						 sizeof(*t->bufs)),
+				GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->bufs);
+
+	t->dev = root_device_register("sun6i-csi-test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->dev);
+
+	t->sdev.regmap = regmap_init(t->dev, NULL, t,
+				     &sun6i_csi_test_regmap_config);
+	if (IS_ERR(t->sdev.regmap)) {
+		root_device_unregister(t->dev);
+		return PTR_ERR(t->sdev.regmap);
+	}
+
+	t->sdev.dev = t->dev;
+	t->sdev.csi.dev = t->dev;
+	t->sdev.csi.v4l2_ep.bus_type = V4L2_MBUS_PARALLEL;
+	u64_stats_init(&t->sdev.csi.stats.syncp);
+	/* Single plane, F0_BUFA holds the buffer address as is */
+	t->sdev.planar_offset[0] = 0;
+	t->sdev.planar_offset[1] = -1;
+	t->sdev.planar_offset[2] = -1;
+
+	video = &t->sdev.csi.video;
+	video->csi = &t->sdev.csi;
+	video->fmt.num_planes = 1;
+	video->decimation = 1;
+	video->frame_decimation = 1;
+	hrtimer_init(&video->slice_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	video->slice_timer.function = sun6i_video_slice_timer;
+
+	t->vq.drv_priv = video;
+	spin_lock_init(&t->vq.done_lock);
+	INIT_LIST_HEAD(&t->vq.done_list);
+	init_waitqueue_head(&t->vq.done_wq);
+
+	for (i = 0; i < SUN6I_CSI_TEST_BUFFERS; i++) {
+		struct vb2_buffer *vb = &t->bufs[i].vb.vb2_buf;
+
+		vb->vb2_queue = &t->vq;
+		vb->index = i;
+		vb->state = VB2_BUF_STATE_DEQUEUED;
+		INIT_LIST_HEAD(&vb->done_entry);
+		t->bufs[i].dma_addr[0] = SUN6I_CSI_TEST_DMA(i);
+	}
+
+	test->priv = t;
+
+	return 0;
+}
+
+static void sun6i_csi_test_exit(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+
+	hrtimer_cancel(&t->sdev.csi.video.slice_timer);
+	regmap_exit(t->sdev.regmap);
+	root_device_unregister(t->dev);
+}
+
+/* vb2 buffer @index of the test queue */
+static struct vb2_buffer *sun6i_csi_test_vb(struct sun6i_csi_test *t,
+					    unsigned int index)
+{
+	return &t->bufs[index].vb.vb2_buf;
+}
+
+/* Queue buffer @index the way VIDIOC_QBUF does while streaming. */
+static void sun6i_csi_test_qbuf(struct sun6i_csi_test *t, unsigned int index)
+{
+	struct vb2_buffer *vb = sun6i_csi_test_vb(t, index);
+
+	/* What DQBUF and QBUF do around the driver's buf_queue */
+	spin_lock_irq(&t->vq.done_lock);
+	list_del_init(&vb->done_entry);
+	spin_unlock_irq(&t->vq.done_lock);
+
+	vb->state = VB2_BUF_STATE_ACTIVE;
+	atomic_inc(&t->vq.owned_by_drv_count);
+
+	sun6i_video_buffer_queue(vb);
+}
+
+/* Address the next frame but one will be written to */
+static u32 sun6i_video_test_bufa(struct sun6i_csi_test *t)
+{
+	return t->regs[CSI_CH_F0_BUFA_REG / 4] << 2;
+}
+
+static int sun6i_video_test_state(struct sun6i_csi_test *t,
+				  unsigned int index)
+{
+	return sun6i_csi_test_vb(t, index)->state;
+}
+
+static u32 sun6i_video_test_sequence(struct sun6i_csi_test *t,
+				     unsigned int index)
+{
+	return to_vb2_v4l2_buffer(sun6i_csi_test_vb(t, index))->sequence;
+}
+
+/* Arm two buffers and start capture, as start_streaming does. */
+static void sun6i_csi_test_start(struct sun6i_csi_test *t)
+{
+	struct sun6i_video *video = &t->sdev.csi.video;
+
+	sun6i_video_ring_arm(video);
+	sun6i_csi_set_capture(&t->sdev.csi, true);
+	sun6i_video_ring_arm(video);
+}
+
+static void sun6i_video_test_queue_arm(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_video *video = &t->sdev.csi.video;
+
+	sun6i_csi_test_qbuf(t, 0);
+	sun6i_csi_test_qbuf(t, 1);
+	sun6i_csi_test_qbuf(t, 2);
+	KUNIT_EXPECT_EQ(test, video->ring_head, 3U);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 0U);
+	KUNIT_EXPECT_PTR_EQ(test, video->ring[2], &t->bufs[2]);
+
+	sun6i_csi_test_start(t);
+	KUNIT_EXPECT_EQ(test, video->ring_armed, 2U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t), SUN6I_CSI_TEST_DMA(1));
+
+	/* Frame 0 in buffer 0, CSI has already latched buffer 1 */
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 1U);
+	KUNIT_EXPECT_EQ(test, video->ring_armed, 3U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t), SUN6I_CSI_TEST_DMA(2));
+
+	/* Retired by the hard IRQ, vb2 only sees it from the IRQ thread */
+	KUNIT_EXPECT_TRUE(test, sun6i_video_complete_pending(video));
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 0),
+			VB2_BUF_STATE_ACTIVE);
+
+	sun6i_video_complete(video);
+	KUNIT_EXPECT_FALSE(test, sun6i_video_complete_pending(video));
+	KUNIT_EXPECT_EQ(test, video->ring_done, 1U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 0), VB2_BUF_STATE_DONE);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, 0), 0U);
+	KUNIT_EXPECT_EQ(test, t->sdev.csi.stats.frames, 1ULL);
+}
+
+static void sun6i_video_test_empty(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_video *video = &t->sdev.csi.video;
+
+	sun6i_csi_test_qbuf(t, 0);
+	sun6i_csi_test_qbuf(t, 1);
+	sun6i_csi_test_start(t);
+
+	/* Frame 0 retired, nothing left to arm for frame 2 */
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 1U);
+	KUNIT_EXPECT_EQ(test, video->ring_armed, 2U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t), SUN6I_CSI_TEST_DMA(1));
+
+	/* Frame 2 goes to buffer 1 as well, frame 1 is dropped */
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 1U);
+	KUNIT_EXPECT_EQ(test, t->sdev.csi.stats.drops, 1ULL);
+
+	/* Late QBUF: armed for frame 4, frame 2 is dropped meanwhile */
+	sun6i_csi_test_qbuf(t, 2);
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 1U);
+	KUNIT_EXPECT_EQ(test, video->ring_armed, 3U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t), SUN6I_CSI_TEST_DMA(2));
+	KUNIT_EXPECT_EQ(test, t->sdev.csi.stats.drops, 2ULL);
+
+	/* Frame 3 in buffer 1 */
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 2U);
+
+	sun6i_video_complete(video);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 0), VB2_BUF_STATE_DONE);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, 0), 0U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 1), VB2_BUF_STATE_DONE);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, 1), 3U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 2),
+			VB2_BUF_STATE_ACTIVE);
+	KUNIT_EXPECT_EQ(test, video->skipped, 2U);
+}
+
+static void sun6i_video_test_full(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_video *video = &t->sdev.csi.video;
+	unsigned int spare = SUN6I_VIDEO_RING_SIZE;
+	unsigned int i;
+
+	/*
+	 * As many buffers as vb2 can hand over. One more would take the
+	 * WARN_ON() path of buffer_queue, which only catches a broken
+	 * ring size and is not replayed here.
+	 */
+	for (i = 0; i < SUN6I_VIDEO_RING_SIZE; i++)
+		sun6i_csi_test_qbuf(t, i);
+	KUNIT_EXPECT_EQ(test, video->ring_head - video->ring_done,
+			(unsigned int)SUN6I_VIDEO_RING_SIZE);
+	for (i = 0; i < SUN6I_VIDEO_RING_SIZE; i++)
+		KUNIT_EXPECT_PTR_EQ(test, video->ring[i], &t->bufs[i]);
+
+	/* All but the buffer CSI keeps writing are retired in order */
+	sun6i_csi_test_start(t);
+	for (i = 0; i < SUN6I_VIDEO_RING_SIZE - 1; i++)
+		sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, video->ring_tail,
+			(unsigned int)SUN6I_VIDEO_RING_SIZE - 1);
+	KUNIT_EXPECT_EQ(test, t->sdev.csi.stats.drops, 0ULL);
+
+	sun6i_video_complete(video);
+	for (i = 0; i < SUN6I_VIDEO_RING_SIZE - 1; i++) {
+		KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, i),
+				VB2_BUF_STATE_DONE);
+		KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, i), i);
+	}
+
+	/* The freed slots are reused from the start of the array */
+	sun6i_csi_test_qbuf(t, spare);
+	KUNIT_EXPECT_PTR_EQ(test, video->ring[0], &t->bufs[spare]);
+
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t),
+			SUN6I_CSI_TEST_DMA(spare));
+	KUNIT_EXPECT_EQ(test, t->sdev.csi.stats.drops, 1ULL);
+}
+
+static void sun6i_video_test_wrap(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_video *video = &t->sdev.csi.video;
+	unsigned int start = UINT_MAX - SUN6I_VIDEO_RING_SIZE / 2;
+	unsigned int frames = 4 * SUN6I_VIDEO_RING_SIZE;
+	unsigned int frame;
+	unsigned int i;
+
+	/* The indices overflow half a ring into the test */
+	video->ring_head = start;
+	video->ring_tail = start;
+	video->ring_armed = start;
+	video->ring_done = start;
+
+	for (i = 0; i < 3; i++)
+		sun6i_csi_test_qbuf(t, i);
+	sun6i_csi_test_start(t);
+
+	/* Userspace requeues every buffer as soon as it dequeues it */
+	for (frame = 0; frame < frames; frame++) {
+		i = frame % 3;
+
+		sun6i_video_frame_done(video);
+		KUNIT_ASSERT_EQ(test, sun6i_video_test_bufa(t),
+				SUN6I_CSI_TEST_DMA((frame + 2) % 3));
+
+		sun6i_video_complete(video);
+		KUNIT_ASSERT_EQ(test, sun6i_video_test_state(t, i),
+				VB2_BUF_STATE_DONE);
+		KUNIT_ASSERT_EQ(test, sun6i_video_test_sequence(t, i), frame);
+
+		sun6i_csi_test_qbuf(t, i);
+	}
+
+	KUNIT_EXPECT_EQ(test, video->ring_done, start + frames);
+	KUNIT_EXPECT_EQ(test, video->ring_head - video->ring_done, 3U);
+	KUNIT_EXPECT_EQ(test, t->sdev.csi.stats.drops, 0ULL);
+}
+
+static void sun6i_video_test_flush(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_video *video = &t->sdev.csi.video;
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		sun6i_csi_test_qbuf(t, i);
+	sun6i_csi_test_start(t);
+	sun6i_video_frame_done(video);
+
+	/* STREAMOFF with frame 0 retired but not yet completed */
+	sun6i_video_ring_flush(video, VB2_BUF_STATE_ERROR);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 0), VB2_BUF_STATE_DONE);
+	for (i = 1; i < 4; i++)
+		KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, i),
+				VB2_BUF_STATE_ERROR);
+
+	KUNIT_EXPECT_EQ(test, video->ring_done, 4U);
+	KUNIT_EXPECT_EQ(test, video->ring_tail, 4U);
+	KUNIT_EXPECT_EQ(test, video->ring_armed, 4U);
+	KUNIT_EXPECT_FALSE(test, sun6i_video_complete_pending(video));
+	KUNIT_EXPECT_EQ(test, atomic_read(&t->vq.owned_by_drv_count), 0);
+}
+
+static void sun6i_video_test_flush_queued(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_video *video = &t->sdev.csi.video;
+
+	/* start_streaming failing gives the buffers back as queued */
+	sun6i_csi_test_qbuf(t, 0);
+	sun6i_csi_test_qbuf(t, 1);
+	sun6i_video_ring_flush(video, VB2_BUF_STATE_QUEUED);
+
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 0),
+			VB2_BUF_STATE_QUEUED);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_state(t, 1),
+			VB2_BUF_STATE_QUEUED);
+	KUNIT_EXPECT_TRUE(test, list_empty(&t->vq.done_list));
+	KUNIT_EXPECT_EQ(test, video->ring_done, video->ring_head);
+
+	/* And the next start finds an empty ring */
+	sun6i_csi_test_qbuf(t, 1);
+	sun6i_csi_test_qbuf(t, 0);
+	sun6i_csi_test_start(t);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_bufa(t), SUN6I_CSI_TEST_DMA(0));
+}
+
+static void sun6i_video_test_sof(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_video *video = &t->sdev.csi.video;
+
+	unsigned int i;
+
+	for (i = 0; i < 3; i++)
+		sun6i_csi_test_qbuf(t, i);
+	sun6i_csi_test_start(t);
+
+	/* A VS at 1 ns dates frame 0 and only frame 0 */
+	video->sof_ts = 1;
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, sun6i_csi_test_vb(t, 0)->timestamp, 1ULL);
+	KUNIT_EXPECT_EQ(test, video->sof_ts, 0ULL);
+
+	/* VS of frame 1 lost, it is dated by its frame done */
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_NE(test, sun6i_csi_test_vb(t, 1)->timestamp, 1ULL);
+	KUNIT_EXPECT_NE(test, sun6i_csi_test_vb(t, 1)->timestamp, 0ULL);
+
+	/* Same for a dropped frame */
+	video->sof_ts = 1;
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, t->sdev.csi.stats.drops, 1ULL);
+	KUNIT_EXPECT_EQ(test, video->sof_ts, 0ULL);
+}
+
+static void sun6i_video_test_decimation(struct kunit *test)
+{
+	struct sun6i_csi_test *t = test->priv;
+	struct sun6i_video *video = &t->sdev.csi.video;
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		sun6i_csi_test_qbuf(t, i);
+	sun6i_csi_test_start(t);
+
+	/* Set mid-frame: frame 0 still counts with the old factor */
+	WRITE_ONCE(video->decimation, 2);
+	sun6i_video_frame_done(video);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, 0), 0U);
+
+	/* Latched by the next vsync */
+	sun6i_video_frame_start(video);
+	sun6i_video_frame_done(video);
+	sun6i_video_frame_start(video);
+	sun6i_video_frame_done(video);
+
+	sun6i_video_complete(video);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, 1), 1U);
+	KUNIT_EXPECT_EQ(test, sun6i_video_test_sequence(t, 2), 3U);
+}
+
+static struct kunit_case sun6i_video_ring_test_cases[] = {
+	KUNIT_CASE(sun6i_video_test_queue_arm),
+	KUNIT_CASE(sun6i_video_test_empty),
+	KUNIT_CASE(sun6i_video_test_full),
+	KUNIT_CASE(sun6i_video_test_wrap),
+	KUNIT_CASE(sun6i_video_test_flush),
+	KUNIT_CASE(sun6i_video_test_flush_queued),
+	KUNIT_CASE(sun6i_video_test_sof),
+	KUNIT_CASE(sun6i_video_test_decimation),
+	{}
+};
+
+static struct kunit_suite sun6i_video_ring_test_suite = {
+	.name		= "sun6i-csi-ring",
+	.init		= sun6i_csi_test_init,
+	.exit		= sun6i_csi_test_exit,
+	.test_cases	= sun6i_video_ring_test_cases,
+};
+
+kunit_test_suites(&sun6i_video_ring_test_suite);
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Allwinner V3s Camera Sensor Interface driver - user space header file.
+ */
+
+#ifndef __UAPI_SUN6I_CSI_H__
+#define __UAPI_SUN6I_CSI_H__
+
+#include <linux/types.h>
+#include <linux/v4l2-controls.h>
+#include <linux/videodev2.h>
+
+/* Private controls of the video node */
+#define V4L2_CID_SUN6I_RECYCLE_MODE	(V4L2_CID_USER_SUN6I_CSI_BASE + 0)
+#define V4L2_CID_SUN6I_SKIPPED_FRAMES	(V4L2_CID_USER_SUN6I_CSI_BASE + 1)
+#define V4L2_CID_SUN6I_CAPTURE_TIME	(V4L2_CID_USER_SUN6I_CSI_BASE + 2)
+#define V4L2_CID_SUN6I_FRAME_DECIMATION	(V4L2_CID_USER_SUN6I_CSI_BASE + 3)
+#define V4L2_CID_SUN6I_SLICE_LINES	(V4L2_CID_USER_SUN6I_CSI_BASE + 4)
+#define V4L2_CID_SUN6I_FRAME_PERIOD	(V4L2_CID_USER_SUN6I_CSI_BASE + 5)
+#define V4L2_CID_SUN6I_PCLK_LINE_MIN	(V4L2_CID_USER_SUN6I_CSI_BASE + 6)
+#define V4L2_CID_SUN6I_PCLK_LINE_MAX	(V4L2_CID_USER_SUN6I_CSI_BASE + 7)
+#define V4L2_CID_SUN6I_FIFO_MAX		(V4L2_CID_USER_SUN6I_CSI_BASE + 8)
+#define V4L2_CID_SUN6I_TPG_RATE		(V4L2_CID_USER_SUN6I_CSI_BASE + 9)
+#define V4L2_CID_SUN6I_LANE_RATE	(V4L2_CID_USER_SUN6I_CSI_BASE + 10)
+#define V4L2_CID_SUN6I_MIPI_ECC_ERRORS	(V4L2_CID_USER_SUN6I_CSI_BASE + 11)
+#define V4L2_CID_SUN6I_MIPI_CRC_ERRORS	(V4L2_CID_USER_SUN6I_CSI_BASE + 12)
+#define V4L2_CID_SUN6I_MIPI_SYNC_ERRORS	(V4L2_CID_USER_SUN6I_CSI_BASE + 13)
+#define V4L2_CID_SUN6I_CRC_DROP		(V4L2_CID_USER_SUN6I_CSI_BASE + 14)
+
+/*
+ * Sent every V4L2_CID_SUN6I_SLICE_LINES lines of the frame in progress,
+ * with a struct sun6i_video_slice_event payload.
+ */
+#define V4L2_EVENT_SUN6I_SLICE		(V4L2_EVENT_PRIVATE_START + 0x1f00)
+
+/**
+ * struct sun6i_video_slice_event - payload of V4L2_EVENT_SUN6I_SLICE
+ * @sequence:	sequence number the frame will be dequeued with
+ * @lines:	lines of the frame already written to memory
+ */
+struct sun6i_video_slice_event {
+	__u32		sequence;
+	__u32		lines;
+};
+
+#endif /* __UAPI_SUN6I_CSI_H__ */